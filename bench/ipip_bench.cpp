@@ -0,0 +1,463 @@
+// ipip_bench: runs the ipip server in-process, drives synthetic load at it
+// over loopback and writes one JSON result line per ingest path.
+//
+//   ipip_bench [--path all|json|array|ndjson|bin|udp] [--port 11320]
+//              [--connections 4] [--figures 4] [--streams 4] [--width 0]
+//              [--rate 1000] [--rows 10] [--duration 5] [--headless]
+//              [--out ipip_bench.jsonl]
+//
+// Every row carries the client send time as its sample time, so the delay
+// until feedData stores it is the ingest latency. --rate is rows per second
+// per connection (0 = as fast as possible), --rows is rows per request
+// (json always sends one), --width adds a heatmap stream of that width to
+// every figure. Without --headless a hidden window renders every frame and
+// the time spent in updateWindow is reported too. ipip runs on its default
+// settings, ignoring ipip.dat, and every line records them under "options".
+
+#include <httplib.h>
+#include <imgui.h>
+#include <implot.h>
+#include <backends/imgui_impl_glfw.h>
+#include <backends/imgui_impl_opengl3.h>
+#include <GLFW/glfw3.h>
+#include <json/json.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ipip.h"
+#include "server.h"
+#include "sample.h"
+
+namespace {
+
+    struct Config {
+        std::string path = "all";
+        int port = 11320;
+        int connections = 4;
+        int figures = 4;
+        int streams = 4;
+        int width = 0;
+        double rate = 1000;
+        int rows = 10;
+        double duration = 5;
+        bool headless = false;
+        std::string out = "ipip_bench.jsonl";
+
+        int rowSamples() const { return figures * (streams + (width > 0)); }
+    };
+
+    double now() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Log scale histogram of durations, about 5% resolution from 1 us to 100 s.
+    struct Histogram {
+        static const int PerDecade = 50;
+        static const int Bins = 8 * PerDecade;
+        std::vector<uint64_t> counts = std::vector<uint64_t>(Bins + 1);
+        uint64_t count{0};
+        double sum{0}, max{0};
+
+        void add(double seconds) {
+            double us = seconds * 1e6;
+            int bin = us <= 1 ? 0 : std::min(Bins, int(std::log10(us) * PerDecade));
+            counts[bin]++;
+            count++;
+            sum += seconds;
+            max = std::max(max, seconds);
+        }
+
+        // Upper edge of the bin holding the q-quantile, in microseconds.
+        double quantile(double q) const {
+            uint64_t target = std::max<uint64_t>(1, (uint64_t)std::ceil(q * count)), seen = 0;
+            for(int bin = 0; bin <= Bins; bin++) {
+                seen += counts[bin];
+                if(seen >= target) return std::min(std::pow(10.0, double(bin + 1) / PerDecade), max * 1e6);
+            }
+            return max * 1e6;
+        }
+
+        Json::Value json() const {
+            Json::Value v;
+            v["count"] = (Json::UInt64)count;
+            if(count == 0) return v;
+            v["mean_us"] = sum / count * 1e6;
+            v["p50_us"] = quantile(0.5);
+            v["p90_us"] = quantile(0.9);
+            v["p99_us"] = quantile(0.99);
+            v["p999_us"] = quantile(0.999);
+            v["max_us"] = max * 1e6;
+            return v;
+        }
+    };
+
+    // Only touched by the thread that runs feedData.
+    Histogram latency;
+    std::atomic<uint64_t> received{0};
+
+    void observeFeed(double time) {
+        latency.add(now() - time);
+        received.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Synthetic rows: figures bench0.. with line streams s0.. and an optional heatmap stream.
+    struct Generator {
+        const Config & cfg;
+        uint64_t seq;
+
+        double value(int f, int s) const { return std::sin(seq * 0.01 + f + s * 0.1); }
+
+        void jsonRow(std::string & out, double t) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "{\"time\":%.17g", t);
+            out += buf;
+            for(int f = 0; f < cfg.figures; f++) {
+                snprintf(buf, sizeof(buf), ",\"bench%d\":{", f);
+                out += buf;
+                for(int s = 0; s < cfg.streams; s++) {
+                    snprintf(buf, sizeof(buf), "%s\"s%d\":%.6g", s ? "," : "", s, value(f, s));
+                    out += buf;
+                }
+                if(cfg.width > 0) {
+                    out += cfg.streams ? ",\"heat\":[" : "\"heat\":[";
+                    for(int k = 0; k < cfg.width; k++) {
+                        snprintf(buf, sizeof(buf), "%s%.6g", k ? "," : "", value(f, k));
+                        out += buf;
+                    }
+                    out += "]";
+                }
+                out += "}";
+            }
+            out += "}";
+            seq++;
+        }
+
+        template<class T> static void put(std::string & out, T v) {
+            out.append((const char *)&v, sizeof(v));
+        }
+
+        static void putName(std::string & out, const std::string & name) {
+            put<uint16_t>(out, (uint16_t)name.size());
+            out += name;
+        }
+
+        // Binary frame of `rows` rows, see parseFrame.
+        void frame(std::string & out, int rows, double t) {
+            int nstream = cfg.rowSamples();
+            out.append(ipip::FrameMagic, sizeof(ipip::FrameMagic));
+            put<uint8_t>(out, 1);
+            put<uint8_t>(out, 0);
+            put<uint16_t>(out, (uint16_t)nstream);
+            put<uint32_t>(out, (uint32_t)rows);
+            for(int f = 0; f < cfg.figures; f++) {
+                for(int s = 0; s <= cfg.streams; s++) {
+                    if(s == cfg.streams && cfg.width == 0) break;
+                    putName(out, "bench" + std::to_string(f));
+                    putName(out, s < cfg.streams ? "s" + std::to_string(s) : "heat");
+                    put<uint8_t>(out, 2);
+                    put<uint8_t>(out, 0);
+                    put<uint32_t>(out, s < cfg.streams ? 1 : cfg.width);
+                }
+            }
+            for(int r = 0; r < rows; r++) put<double>(out, t);
+            for(int f = 0; f < cfg.figures; f++) {
+                for(int s = 0; s < cfg.streams; s++) {
+                    for(int r = 0; r < rows; r++) put<double>(out, std::sin((seq + r) * 0.01 + f + s * 0.1));
+                }
+                if(cfg.width > 0) {
+                    for(int r = 0; r < rows; r++) {
+                        for(int k = 0; k < cfg.width; k++) put<double>(out, std::sin((seq + r) * 0.01 + f + k * 0.1));
+                    }
+                }
+            }
+            seq += rows;
+        }
+    };
+
+    struct Load {
+        const Config & cfg;
+        std::string path;
+        double deadline;
+        std::atomic<uint64_t> sent{0}, rejected{0}, requests{0};
+        std::atomic<int> running{0};
+    };
+
+    // Sleeps until the next request is due; does not burst to catch up after a stall.
+    void pace(double & next, double interval) {
+        if(interval <= 0) return;
+        double t = now();
+        next = std::max(next + interval, t - 1);
+        if(next > t) std::this_thread::sleep_for(std::chrono::duration<double>(next - t));
+    }
+
+    void runConnection(Load & load, int id) {
+        const Config & cfg = load.cfg;
+        Generator gen{cfg, uint64_t(id) << 32};
+        int rows = load.path == "json" ? 1 : cfg.rows;
+        uint64_t samples = uint64_t(rows) * cfg.rowSamples();
+        double interval = cfg.rate > 0 ? rows / cfg.rate : 0;
+        double next = now();
+        std::string host = "http://127.0.0.1:" + std::to_string(cfg.port);
+        std::string body;
+        auto build = [&]() {
+            body.clear();
+            double t = now();
+            if(load.path == "bin" || load.path == "udp") {
+                gen.frame(body, rows, t);
+                return;
+            }
+            if(load.path == "array") body += '[';
+            for(int r = 0; r < rows; r++) {
+                if(r > 0) body += load.path == "array" ? "," : "";
+                gen.jsonRow(body, t);
+                if(load.path == "ndjson") body += '\n';
+            }
+            if(load.path == "array") body += ']';
+        };
+
+        if(load.path == "ndjson") {
+            httplib::Client cli(host);
+            cli.set_write_timeout(60);
+            auto res = cli.Post("/", [&](size_t, httplib::DataSink & sink) {
+                if(now() >= load.deadline) {
+                    sink.done();
+                    return true;
+                }
+                pace(next, interval);
+                build();
+                load.sent += samples;
+                load.requests++;
+                return sink.write(body.data(), body.size());
+            }, "application/x-ndjson");
+            if(!res || res->status != 200) std::cerr << "ndjson stream " << id << " failed" << std::endl;
+        }
+        else if(load.path == "udp") {
+            socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = htons(cfg.port);
+            while(now() < load.deadline) {
+                pace(next, interval);
+                build();
+                int n = sendto(sock, body.data(), (int)body.size(), 0, (const sockaddr *)&addr, sizeof(addr));
+                load.sent += samples;
+                load.requests++;
+                if(n != (int)body.size()) load.rejected += samples;
+            }
+            httplib::detail::close_socket(sock);
+        }
+        else {
+            httplib::Client cli(host);
+            cli.set_keep_alive(true);
+            const char * target = load.path == "bin" ? "/bin" : "/";
+            const char * type = load.path == "bin" ? "application/octet-stream" : "application/json";
+            while(now() < load.deadline) {
+                pace(next, interval);
+                build();
+                auto res = cli.Post(target, body, type);
+                load.sent += samples;
+                load.requests++;
+                if(!res || res->status != 200) load.rejected += samples;
+            }
+        }
+        load.running--;
+    }
+
+    struct Renderer {
+        GLFWwindow * window{nullptr};
+        Histogram frames;
+
+        bool init() {
+            if(!glfwInit()) return false;
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+            window = glfwCreateWindow(1600, 900, "ipip_bench", NULL, NULL);
+            if(!window) {
+                glfwTerminate();
+                return false;
+            }
+            glfwMakeContextCurrent(window);
+            glfwSwapInterval(0);
+            IMGUI_CHECKVERSION();
+            ImGui::CreateContext();
+            ImPlot::CreateContext();
+            ImGui_ImplGlfw_InitForOpenGL(window, true);
+            ImGui_ImplOpenGL3_Init("#version 130");
+            return true;
+        }
+
+        void frame() {
+            glfwPollEvents();
+            ImGui_ImplOpenGL3_NewFrame();
+            ImGui_ImplGlfw_NewFrame();
+            ImGui::NewFrame();
+            double t0 = now();
+            ipip::updateWindow(window);
+            frames.add(now() - t0);
+            ImGui::Render();
+            int w, h;
+            glfwGetFramebufferSize(window, &w, &h);
+            glViewport(0, 0, w, h);
+            glClear(GL_COLOR_BUFFER_BIT);
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            glfwSwapBuffers(window);
+        }
+
+        void shutdown() {
+            if(!window) return;
+            ImGui_ImplOpenGL3_Shutdown();
+            ImGui_ImplGlfw_Shutdown();
+            ImPlot::DestroyContext();
+            ImGui::DestroyContext();
+            glfwDestroyWindow(window);
+            glfwTerminate();
+        }
+    };
+
+    Json::Value runPath(const Config & cfg, const std::string & path, Renderer * renderer) {
+        latency = Histogram{};
+        received = 0;
+        if(renderer) renderer->frames = Histogram{};
+        ipip::QueueStats queue0 = ipip::queueStats();
+        ipip::UdpStats udp0 = ipip::udpStats();
+        if(!renderer) ipip::initHeadless();
+
+        Load load{cfg, path, now() + cfg.duration};
+        double start = now();
+        load.running = cfg.connections;
+        std::vector<std::thread> clients;
+        for(int i = 0; i < cfg.connections; i++) {
+            clients.emplace_back(runConnection, std::ref(load), i);
+        }
+        // Keep rendering until the load stops and the last samples arrive,
+        // or nothing has arrived for half a second.
+        double loadEnd = 0, lastChange = now();
+        uint64_t lastReceived = 0;
+        for(;;) {
+            if(renderer) renderer->frame();
+            else std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            double t = now();
+            uint64_t got = received;
+            if(got != lastReceived) {
+                lastReceived = got;
+                lastChange = t;
+            }
+            if(load.running > 0) continue;
+            if(loadEnd == 0) loadEnd = t;
+            if(got >= load.sent || t - lastChange > 0.5 || t - loadEnd > 10) break;
+        }
+        for(auto & th: clients) th.join();
+        if(!renderer) ipip::stopHeadless();
+
+        ipip::QueueStats queue1 = ipip::queueStats();
+        ipip::UdpStats udp1 = ipip::udpStats();
+        double elapsed = loadEnd - start;
+        uint64_t sent = load.sent;
+        Json::Value result;
+        result["path"] = path;
+        result["connections"] = cfg.connections;
+        result["figures"] = cfg.figures;
+        result["streams"] = cfg.streams;
+        result["width"] = cfg.width;
+        result["rate"] = cfg.rate;
+        result["rows"] = path == "json" ? 1 : cfg.rows;
+        result["duration_s"] = elapsed;
+        result["requests"] = (Json::UInt64)load.requests.load();
+        result["sent"] = (Json::UInt64)sent;
+        result["received"] = (Json::UInt64)received.load();
+        result["dropped"] = (Json::UInt64)(sent > received ? sent - received : 0);
+        result["rejected"] = (Json::UInt64)load.rejected.load();
+        result["queue_overflow"] = (Json::UInt64)(queue1.overflow - queue0.overflow);
+        result["udp_malformed"] = (Json::UInt64)(udp1.malformed - udp0.malformed);
+        result["samples_per_s"] = elapsed > 0 ? received / elapsed : 0;
+        result["latency"] = latency.json();
+        if(renderer) result["update_window"] = renderer->frames.json();
+        result["options"] = ipip::optionsJson();
+        return result;
+    }
+
+} // namespace
+
+int main(int argc, char ** argv) {
+    Config cfg;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto next = [&]() -> const char * {
+            if(i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << std::endl;
+                exit(1);
+            }
+            return argv[++i];
+        };
+        if(arg == "--path") cfg.path = next();
+        else if(arg == "--port") cfg.port = atoi(next());
+        else if(arg == "--connections") cfg.connections = std::max(1, atoi(next()));
+        else if(arg == "--figures") cfg.figures = std::max(1, atoi(next()));
+        else if(arg == "--streams") cfg.streams = std::max(0, atoi(next()));
+        else if(arg == "--width") cfg.width = std::max(0, atoi(next()));
+        else if(arg == "--rate") cfg.rate = atof(next());
+        else if(arg == "--rows") cfg.rows = std::max(1, atoi(next()));
+        else if(arg == "--duration") cfg.duration = atof(next());
+        else if(arg == "--headless") cfg.headless = true;
+        else if(arg == "--out") cfg.out = next();
+        else {
+            std::cerr << "Unknown argument " << arg << std::endl;
+            return 1;
+        }
+    }
+    if(cfg.rowSamples() == 0) {
+        std::cerr << "Nothing to send: need --streams or --width" << std::endl;
+        return 1;
+    }
+    std::vector<std::string> paths = {"json", "array", "ndjson", "bin", "udp"};
+    if(cfg.path != "all") {
+        if(std::find(paths.begin(), paths.end(), cfg.path) == paths.end()) {
+            std::cerr << "Unknown path " << cfg.path << std::endl;
+            return 1;
+        }
+        paths = {cfg.path};
+    }
+
+    // Whatever ipip.dat is lying around must not change the numbers.
+    ipip::useDefaultOptions();
+    ipip::setFeedObserver(observeFeed);
+    ipip::initServer(cfg.port);
+    double wait = now() + 5;
+    while(!httplib::Client("http://127.0.0.1:" + std::to_string(cfg.port)).Get("/status")) {
+        if(now() > wait) {
+            std::cerr << "Server did not start on port " << cfg.port << std::endl;
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    Renderer renderer;
+    bool gui = !cfg.headless && renderer.init();
+    if(!cfg.headless && !gui) std::cerr << "No window available, running headless" << std::endl;
+
+    std::ofstream out(cfg.out, std::ios::app);
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    for(auto & path: paths) {
+        Json::Value result = runPath(cfg, path, gui ? &renderer : nullptr);
+        std::string line = Json::writeString(builder, result);
+        out << line << std::endl;
+        std::cerr << path << ": " << result["samples_per_s"].asDouble() << " samples/s, "
+                  << result["dropped"].asUInt64() << " dropped, p99 latency "
+                  << result["latency"].get("p99_us", 0).asDouble() << " us" << std::endl;
+    }
+
+    renderer.shutdown();
+    ipip::stopServer();
+    return 0;
+}
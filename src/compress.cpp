@@ -0,0 +1,220 @@
+#include "compress.h"
+#include <algorithm>
+#include <cstring>
+
+namespace ipip {
+
+    static uint64_t bitsOf(double v) {
+        uint64_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        return bits;
+    }
+
+    static double doubleOf(uint64_t bits) {
+        double v;
+        memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+
+    static int leadingZeros(uint64_t x) {
+        int n = 0;
+        for(uint64_t bit = uint64_t(1) << 63; bit && !(x & bit); bit >>= 1) n++;
+        return n;
+    }
+
+    static int trailingZeros(uint64_t x) {
+        int n = 0;
+        for(; n < 64 && !(x & 1); x >>= 1) n++;
+        return n;
+    }
+
+    struct BitWriter {
+        std::vector<uint64_t> & words;
+        int used{64};
+
+        void write(uint64_t value, int bits) {
+            if(bits < 64) value &= (uint64_t(1) << bits) - 1;
+            while(bits > 0) {
+                if(used == 64) {
+                    words.push_back(0);
+                    used = 0;
+                }
+                int n = std::min(bits, 64 - used);
+                uint64_t part = value >> (bits - n);
+                if(n < 64) part &= (uint64_t(1) << n) - 1;
+                words.back() |= part << (64 - used - n);
+                used += n;
+                bits -= n;
+            }
+        }
+    };
+
+    struct BitReader {
+        const uint64_t * words;
+        size_t pos{0};
+
+        uint64_t read(int bits) {
+            uint64_t value = 0;
+            while(bits > 0) {
+                size_t word = pos / 64;
+                int offset = pos % 64;
+                int n = std::min(bits, 64 - offset);
+                uint64_t part = words[word] >> (64 - offset - n);
+                if(n < 64) part &= (uint64_t(1) << n) - 1;
+                value = n < 64 ? (value << n) | part : part;
+                pos += n;
+                bits -= n;
+            }
+            return value;
+        }
+
+        bool bit() {
+            bool set = (words[pos / 64] >> (63 - pos % 64)) & 1;
+            pos++;
+            return set;
+        }
+
+        uint64_t peek(int bits) {
+            BitReader copy = *this;
+            return copy.read(bits);
+        }
+    };
+
+    // Delta-of-delta buckets: '0', then '10', '110', '1110', '11110' with
+    // 7, 9, 12 and 32 bit payloads, and '11111' with the raw 64 bits.
+    static const int DodBits[] = {7, 9, 12, 32};
+
+    static void writeDod(BitWriter & w, int64_t dod) {
+        if(dod == 0) {
+            w.write(0, 1);
+            return;
+        }
+        for(int i = 0; i < 4; i++) {
+            int64_t half = int64_t(1) << (DodBits[i] - 1);
+            if(dod >= -half && dod < half) {
+                w.write((uint64_t(1) << (i + 2)) - 2, i + 2);
+                w.write(uint64_t(dod), DodBits[i]);
+                return;
+            }
+        }
+        w.write(31, 5);
+        w.write(uint64_t(dod), 64);
+    }
+
+    static int64_t readDod(BitReader & r) {
+        if(!r.bit()) return 0;
+        // Take the rest of the prefix at once. Every bucket has at least 8
+        // more bits, so the peek stays inside the block.
+        uint64_t prefix = r.peek(4);
+        int ones = 1;
+        while(ones < 5 && (prefix & (uint64_t(1) << (4 - ones)))) ones++;
+        r.pos += std::min(ones, 4);
+        if(ones == 5) return (int64_t)r.read(64);
+        int bits = DodBits[ones - 1];
+        uint64_t raw = r.read(bits);
+        // Sign-extend.
+        if(raw & (uint64_t(1) << (bits - 1))) raw |= ~uint64_t(0) << bits;
+        return (int64_t)raw;
+    }
+
+    GorillaBlock GorillaBlock::encode(const double * time, const double * value, size_t rows) {
+        GorillaBlock block{time[0], time[0], (uint32_t)rows, {}};
+        BitWriter w{block.words};
+        uint64_t prevTime = bitsOf(time[0]), prevValue = bitsOf(value[0]);
+        // Deltas wrap around in unsigned arithmetic, so any jump (a clock
+        // reset, say) is well defined; only the stored dod is signed.
+        uint64_t prevDelta = 0;
+        int lead = -1, trail = 0;
+        w.write(prevTime, 64);
+        w.write(prevValue, 64);
+        for(size_t i = 1; i < rows; i++) {
+            block.tmin = std::min(block.tmin, time[i]);
+            block.tmax = std::max(block.tmax, time[i]);
+            uint64_t t = bitsOf(time[i]);
+            uint64_t delta = t - prevTime;
+            writeDod(w, (int64_t)(delta - prevDelta));
+            prevDelta = delta;
+            prevTime = t;
+
+            uint64_t v = bitsOf(value[i]);
+            uint64_t x = v ^ prevValue;
+            prevValue = v;
+            if(x == 0) {
+                w.write(0, 1);
+                continue;
+            }
+            int l = std::min(leadingZeros(x), 31), t0 = trailingZeros(x);
+            if(lead >= 0 && l >= lead && t0 >= trail) {
+                // Fits the previous meaningful window.
+                w.write(2, 2);
+                w.write(x >> trail, 64 - lead - trail);
+                continue;
+            }
+            lead = l;
+            trail = t0;
+            int length = 64 - lead - trail;
+            w.write(3, 2);
+            w.write(lead, 5);
+            w.write(length & 63, 6);
+            w.write(x >> trail, length);
+        }
+        block.words.shrink_to_fit();
+        return block;
+    }
+
+    void GorillaBlock::decode(double * time, double * value) const {
+        BitReader r{words.data()};
+        uint64_t t = r.read(64), v = r.read(64);
+        uint64_t delta = 0;
+        int lead = 0, trail = 0;
+        time[0] = doubleOf(t);
+        value[0] = doubleOf(v);
+        for(uint32_t i = 1; i < rows; i++) {
+            delta += (uint64_t)readDod(r);
+            t += delta;
+            time[i] = doubleOf(t);
+            if(r.bit()) {
+                if(r.bit()) {
+                    lead = (int)r.read(5);
+                    int length = (int)r.read(6);
+                    if(length == 0) length = 64;
+                    trail = 64 - lead - length;
+                }
+                v ^= r.read(64 - lead - trail) << trail;
+            }
+            value[i] = doubleOf(v);
+        }
+    }
+
+    void CompressedSeries::push(double time, double value) {
+        headTime.push_back(time);
+        headValue.push_back(value);
+        if(headTime.size() < BlockRows) return;
+        blocks.push_back(GorillaBlock::encode(headTime.data(), headValue.data(), headTime.size()));
+        sealedRows += headTime.size();
+        sealed++;
+        headTime.clear();
+        headValue.clear();
+    }
+
+    void CompressedSeries::trim(double before) {
+        while(!blocks.empty() && blocks.front().tmax < before) {
+            sealedRows -= blocks.front().rows;
+            blocks.pop_front();
+        }
+    }
+
+    void CompressedSeries::clear() {
+        blocks.clear();
+        headTime.clear();
+        headValue.clear();
+        sealedRows = 0;
+    }
+
+    size_t CompressedSeries::bytes() const {
+        size_t bytes = (headTime.capacity() + headValue.capacity()) * sizeof(double);
+        for(auto & block: blocks) bytes += block.bytes();
+        return bytes;
+    }
+
+} // namespace ipip
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace ipip {
+
+    // Gorilla-style compressed column of (time, value) samples. Times are
+    // delta-of-delta coded on their IEEE bit patterns, which stay lossless
+    // and are near zero for regularly sampled data; values are XORed with
+    // their predecessor and only the meaningful bits are kept. Samples
+    // collect in a small uncompressed head and are sealed into immutable
+    // blocks of BlockRows.
+    struct GorillaBlock {
+        double tmin;
+        double tmax;
+        uint32_t rows;
+        std::vector<uint64_t> words;
+
+        static GorillaBlock encode(const double * time, const double * value, size_t rows);
+        // `time` and `value` must hold `rows` entries.
+        void decode(double * time, double * value) const;
+        size_t bytes() const { return words.capacity() * sizeof(uint64_t) + sizeof(*this); }
+    };
+
+    struct CompressedSeries {
+        static const size_t BlockRows = 1024;
+
+        std::deque<GorillaBlock> blocks;
+        std::vector<double> headTime, headValue;
+        size_t sealedRows{0};
+        // Blocks sealed so far, including trimmed ones.
+        uint64_t sealed{0};
+
+        void push(double time, double value);
+        // Drops the blocks that end before `before`.
+        void trim(double before);
+        void clear();
+
+        bool empty() const { return blocks.empty() && headTime.empty(); }
+        size_t rows() const { return sealedRows + headTime.size(); }
+        size_t bytes() const;
+        double front() const { return blocks.empty() ? headTime.front() : blocks.front().tmin; }
+        double back() const { return headTime.empty() ? blocks.back().tmax : headTime.back(); }
+
+        // Calls f(time, value, rows) for the sealed blocks from index `begin`
+        // on that overlap [lo, hi], decoding each into a reused scratch
+        // buffer. The head is read directly.
+        template<class F> void scan(size_t begin, double lo, double hi, F f) const {
+            for(size_t i = begin; i < blocks.size(); i++) {
+                const GorillaBlock & block = blocks[i];
+                if(block.tmax < lo) continue;
+                if(block.tmin > hi) return;
+                scratchTime.resize(block.rows);
+                scratchValue.resize(block.rows);
+                block.decode(scratchTime.data(), scratchValue.data());
+                f(scratchTime.data(), scratchValue.data(), (size_t)block.rows);
+            }
+        }
+
+        // Calls f(time, value) for every row from time `lo` on, oldest first.
+        template<class F> void each(double lo, F f) const {
+            scan(0, lo, INFINITY, [&](const double * time, const double * value, size_t rows) {
+                for(size_t i = 0; i < rows; i++) {
+                    if(time[i] >= lo) f(time[i], value[i]);
+                }
+            });
+            for(size_t i = 0; i < headTime.size(); i++) {
+                if(headTime[i] >= lo) f(headTime[i], headValue[i]);
+            }
+        }
+
+    private:
+        mutable std::vector<double> scratchTime, scratchValue;
+    };
+
+} // namespace ipip
@@ -0,0 +1,276 @@
+#include "derive.h"
+#include "queue.h"
+#include "server.h"
+#include <json/json.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace ipip {
+
+    struct Spectrogram {
+        SpectrogramSpec spec;
+        uint32_t subplot, stream;
+        uint32_t outSubplot, outStream;
+        // Written by the owning worker only.
+        RealFft fft;
+        std::vector<double> ring, row;
+        size_t pos{0}, filled{0}, since{0};
+    };
+
+    // Scalar samples of watched streams, in feed order.
+    struct DeriveInput {
+        std::vector<uint32_t> ids;
+        std::vector<double> time;
+        std::vector<double> value;
+    };
+
+    // Sleeps on `ready` while its queue is empty; deriveBatch notifies it.
+    struct DeriveWorker {
+        MpscRing<DeriveInput> queue{1 << 10};
+        std::mutex lock;
+        std::condition_variable ready;
+        std::thread thread;
+    };
+
+    static const char * functionNames[] = {"rect", "hann", "hamming", "blackman"};
+
+    // Ids index `derived` and are never reused; a replaced spectrogram keeps its id.
+    static std::mutex deriveLock;
+    static std::vector<std::shared_ptr<Spectrogram>> derived;
+    static std::atomic<uint64_t> deriveVersion{0};
+    // Started with the first spectrogram, before deriveVersion leaves 0, so
+    // the render thread never sees the vector change.
+    static std::vector<std::unique_ptr<DeriveWorker>> workers;
+    static std::atomic<bool> deriveRunning{false};
+    static std::atomic<uint64_t> deriveRows{0}, deriveDropped{0};
+
+    static void deriveLoop(DeriveWorker * worker);
+
+    // Caller holds deriveLock.
+    static void startWorkers() {
+        unsigned count = std::max(1u, std::min(4u, std::thread::hardware_concurrency() / 2));
+        for(unsigned i = 0; i < count; i++) {
+            workers.push_back(std::make_unique<DeriveWorker>());
+            workers.back()->thread = std::thread(deriveLoop, workers.back().get());
+        }
+    }
+
+    // Optional members must have their type; jsoncpp would throw a
+    // Json::LogicError from the accessor otherwise.
+    static void checkMember(const Json::Value & root, const char * key, bool (Json::Value::*is)() const, const char * type) {
+        if(root.isMember(key) && !(root[key].*is)()) {
+            throw std::runtime_error(std::string("`") + key + "` must be " + type);
+        }
+    }
+
+    SpectrogramSpec parseSpectrogram(const char * begin, const char * end) {
+        Json::CharReaderBuilder builder;
+        std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+        Json::Value root;
+        std::string errs;
+        if(!reader->parse(begin, end, &root, &errs)) throw std::runtime_error(errs);
+        if(!root.isObject() || !root["figure"].isString() || !root["stream"].isString()) {
+            throw std::runtime_error("expected an object with string `figure` and `stream`");
+        }
+        checkMember(root, "output", &Json::Value::isString, "a string");
+        checkMember(root, "window", &Json::Value::isUInt, "a non-negative integer");
+        checkMember(root, "hop", &Json::Value::isUInt, "a non-negative integer");
+        checkMember(root, "db", &Json::Value::isBool, "a boolean");
+        checkMember(root, "function", &Json::Value::isString, "a string");
+        SpectrogramSpec spec;
+        spec.figure = root["figure"].asString();
+        spec.stream = root["stream"].asString();
+        spec.output = root.get("output", spec.figure + "." + spec.stream + ".fft").asString();
+        spec.window = root.get("window", spec.window).asUInt();
+        spec.hop = root.get("hop", spec.hop).asUInt();
+        spec.db = root.get("db", spec.db).asBool();
+        if(root.isMember("function")) {
+            std::string name = root["function"].asString();
+            auto it = std::find(std::begin(functionNames), std::end(functionNames), name);
+            if(it == std::end(functionNames)) throw std::runtime_error("unknown window function " + name);
+            spec.function = (WindowFunction)(it - std::begin(functionNames));
+        }
+        if(!RealFft::valid(spec.window) || spec.window > (1u << 16)) {
+            throw std::runtime_error("window must be a power of two between 8 and 65536");
+        }
+        if(spec.hop == 0) throw std::runtime_error("hop must be positive");
+        if(spec.output == spec.figure) throw std::runtime_error("output must differ from the source figure");
+        return spec;
+    }
+
+    void addSpectrogram(const SpectrogramSpec & spec) {
+        auto sg = std::make_shared<Spectrogram>();
+        sg->spec = spec;
+        sg->subplot = internSubplot(spec.figure);
+        sg->stream = internStream(sg->subplot, spec.stream);
+        sg->outSubplot = internSubplot(spec.output);
+        sg->outStream = internStream(sg->outSubplot, spec.stream);
+        sg->fft.init(spec.window, spec.function);
+        sg->ring.assign(spec.window, 0);
+        sg->row.resize(spec.window / 2 + 1);
+        std::lock_guard<std::mutex> guard(deriveLock);
+        if(!deriveRunning) throw std::runtime_error("derived streams are not running");
+        if(workers.empty()) startWorkers();
+        auto it = std::find_if(derived.begin(), derived.end(), [&](const std::shared_ptr<Spectrogram> & d) {
+            return d->subplot == sg->subplot && d->stream == sg->stream && d->outSubplot == sg->outSubplot;
+        });
+        if(it != derived.end()) *it = sg;
+        else derived.push_back(sg);
+        deriveVersion.fetch_add(1, std::memory_order_release);
+    }
+
+    std::string listDerived() {
+        Json::Value root = Json::arrayValue;
+        {
+            std::lock_guard<std::mutex> guard(deriveLock);
+            for(auto & d: derived) {
+                Json::Value item;
+                item["figure"] = d->spec.figure;
+                item["stream"] = d->spec.stream;
+                item["output"] = d->spec.output;
+                item["window"] = d->spec.window;
+                item["hop"] = d->spec.hop;
+                item["function"] = functionNames[d->spec.function];
+                item["db"] = d->spec.db;
+                root.append(item);
+            }
+        }
+        Json::StreamWriterBuilder builder;
+        builder["indentation"] = "";
+        return Json::writeString(builder, root);
+    }
+
+    // Appends one sample; emits a row once the window is full and `hop`
+    // samples arrived since the last one.
+    static void deriveSample(Spectrogram & sg, double time, double value, SampleBatch & out) {
+        size_t n = sg.ring.size();
+        sg.ring[sg.pos] = value;
+        sg.pos = sg.pos + 1 == n ? 0 : sg.pos + 1;
+        sg.filled = std::min(sg.filled + 1, n);
+        if(++sg.since < sg.spec.hop || sg.filled < n) return;
+        sg.since = 0;
+        sg.fft.magnitude(sg.ring.data() + sg.pos, n - sg.pos, sg.ring.data(), sg.row.data());
+        if(sg.spec.db) {
+            for(auto & v: sg.row) v = 20 * log10(v + 1e-6);
+        }
+        out.add(sg.outSubplot, sg.outStream, time, sg.row.data(), (uint32_t)sg.row.size());
+    }
+
+    static void deriveLoop(DeriveWorker * worker) {
+        std::vector<std::shared_ptr<Spectrogram>> table;
+        uint64_t seen = 0;
+        DeriveInput input;
+        SampleBatch out;
+        while(deriveRunning) {
+            if(!worker->queue.pop(input)) {
+                std::unique_lock<std::mutex> guard(worker->lock);
+                worker->ready.wait(guard, [&] { return !deriveRunning || worker->queue.depth() > 0; });
+                continue;
+            }
+            // The render thread only routes ids it read from the registry.
+            if(deriveVersion.load(std::memory_order_acquire) != seen) {
+                std::lock_guard<std::mutex> guard(deriveLock);
+                table = derived;
+                seen = deriveVersion.load(std::memory_order_relaxed);
+            }
+            for(size_t i = 0; i < input.ids.size(); i++) {
+                deriveSample(*table[input.ids[i]], input.time[i], input.value[i], out);
+            }
+            if(out.empty()) continue;
+            // Rows go back through the ingest queue; give the render thread a
+            // moment to drain it before dropping them.
+            size_t rows = out.records.size();
+            for(int tries = 0; ; tries++) {
+                if(pushQueue(std::move(out))) {
+                    deriveRows += rows;
+                    break;
+                }
+                if(tries == 100 || !deriveRunning) {
+                    deriveDropped += rows;
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            out.clear();
+        }
+    }
+
+    static void wakeWorker(DeriveWorker & worker) {
+        // Taking the lock orders this with the worker's empty check.
+        { std::lock_guard<std::mutex> guard(worker.lock); }
+        worker.ready.notify_one();
+    }
+
+    void initDerive() {
+        deriveRunning = true;
+    }
+
+    // Called once nothing feeds deriveBatch any more. Workers may need
+    // deriveLock to finish, so they are joined outside of it.
+    void stopDerive() {
+        std::vector<std::unique_ptr<DeriveWorker>> stopping;
+        {
+            std::lock_guard<std::mutex> guard(deriveLock);
+            deriveRunning = false;
+            stopping.swap(workers);
+        }
+        for(auto & worker: stopping) {
+            wakeWorker(*worker);
+            worker->thread.join();
+        }
+    }
+
+    // Render thread only: [subplot][stream] -> ids of the spectrograms fed by it.
+    static std::vector<std::vector<std::vector<uint32_t>>> taps;
+    static uint64_t tapsVersion = 0;
+    static std::vector<DeriveInput> pending;
+
+    void deriveBatch(const SampleBatch & batch, size_t begin, size_t end) {
+        uint64_t version = deriveVersion.load(std::memory_order_acquire);
+        if(version == 0 || workers.empty()) return;
+        if(version != tapsVersion) {
+            taps.clear();
+            std::lock_guard<std::mutex> guard(deriveLock);
+            for(uint32_t id = 0; id < derived.size(); id++) {
+                auto & d = *derived[id];
+                if(d.subplot >= taps.size()) taps.resize(d.subplot + 1);
+                if(d.stream >= taps[d.subplot].size()) taps[d.subplot].resize(d.stream + 1);
+                taps[d.subplot][d.stream].push_back(id);
+            }
+            tapsVersion = version;
+            pending.resize(workers.size());
+        }
+        const double * values = batch.values.data();
+        for(size_t i = begin; i < end; i++) {
+            auto & rec = batch.records[i];
+            if(rec.count != 1 || rec.subplot >= taps.size() || rec.stream >= taps[rec.subplot].size()) continue;
+            for(uint32_t id: taps[rec.subplot][rec.stream]) {
+                DeriveInput & in = pending[id % workers.size()];
+                in.ids.push_back(id);
+                in.time.push_back(rec.time);
+                in.value.push_back(values[rec.offset]);
+            }
+        }
+        for(size_t w = 0; w < workers.size(); w++) {
+            if(pending[w].ids.empty()) continue;
+            size_t samples = pending[w].ids.size();
+            if(workers[w]->queue.push(std::move(pending[w]))) wakeWorker(*workers[w]);
+            else deriveDropped += samples;
+            pending[w] = DeriveInput{};
+        }
+    }
+
+    DeriveStats deriveStats() {
+        std::lock_guard<std::mutex> guard(deriveLock);
+        return DeriveStats{derived.size(), deriveRows.load(), deriveDropped.load()};
+    }
+
+} // namespace ipip
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "fft.h"
+#include "sample.h"
+
+namespace ipip {
+
+    // Spectrogram derived from a scalar stream: every `hop` samples the last
+    // `window` samples are windowed and transformed on a worker thread, and
+    // the window / 2 + 1 bin magnitudes come back through the ingest queue
+    // as one row of a heatmap stream named like the source, in figure
+    // `output` (default "<figure>.<stream>.fft").
+    struct SpectrogramSpec {
+        std::string figure;
+        std::string stream;
+        std::string output;
+        uint32_t window{256};
+        uint32_t hop{64};
+        WindowFunction function{WindowHann};
+        bool db{false};
+    };
+
+    struct DeriveStats {
+        size_t streams;
+        uint64_t rows;
+        uint64_t dropped;
+    };
+
+    // Parses {"figure": "fig1", "stream": "acc", "window": 256, "hop": 64,
+    // "function": "hann" | "hamming" | "blackman" | "rect", "db": false,
+    // "output": "..."}; only figure and stream are required. Throws
+    // std::runtime_error on malformed or out of range input.
+    SpectrogramSpec parseSpectrogram(const char * begin, const char * end);
+
+    // Declares a spectrogram, replacing the one with the same source and
+    // output. Throws std::runtime_error when the workers are not running.
+    void addSpectrogram(const SpectrogramSpec & spec);
+    // JSON array of the declared spectrograms.
+    std::string listDerived();
+
+    // Enables spectrograms; the worker threads only start with the first one
+    // and sleep while they have no input.
+    void initDerive();
+    void stopDerive();
+    // Called by the render thread with every fed range of a batch; hands the
+    // scalar samples of watched streams to the workers without blocking.
+    void deriveBatch(const SampleBatch & batch, size_t begin, size_t end);
+    DeriveStats deriveStats();
+
+} // namespace ipip
@@ -0,0 +1,65 @@
+#include "drawcache.h"
+#include <imgui_internal.h>
+#include <cstring>
+
+namespace ipip {
+
+    DrawCache::Mark DrawCache::mark(ImDrawList * list) {
+        // Start a fresh command so nothing drawn before the plot is captured.
+        list->AddDrawCmd();
+        return Mark{list->CmdBuffer.Size - 1, list->IdxBuffer.Size, list->VtxBuffer.Size};
+    }
+
+    void DrawCache::capture(ImDrawList * list, const Mark & from) {
+        vtx.assign(list->VtxBuffer.Data + from.vtx, list->VtxBuffer.Data + list->VtxBuffer.Size);
+        idx.clear();
+        cmds.clear();
+        for(int i = from.cmd; i < list->CmdBuffer.Size; i++) {
+            const ImDrawCmd & cmd = list->CmdBuffer[i];
+            if(cmd.ElemCount == 0 || cmd.UserCallback) continue;
+            cmds.push_back(Cmd{cmd.ClipRect, cmd.TextureId, (unsigned)idx.size(), cmd.ElemCount});
+            for(unsigned k = 0; k < cmd.ElemCount; k++) {
+                idx.push_back(list->IdxBuffer[cmd.IdxOffset + k] + cmd.VtxOffset - from.vtx);
+            }
+        }
+        list->AddDrawCmd();
+        valid = true;
+    }
+
+    void DrawCache::replay(ImDrawList * list) const {
+        if(vtx.empty()) return;
+        ImDrawIdx base = list->_VtxCurrentIdx;
+        list->PrimReserve(0, vtx.size());
+        memcpy(list->_VtxWritePtr, vtx.data(), vtx.size() * sizeof(ImDrawVert));
+        list->_VtxWritePtr += vtx.size();
+        list->_VtxCurrentIdx += vtx.size();
+        for(auto & cmd: cmds) {
+            list->PushClipRect(ImVec2(cmd.clip.x, cmd.clip.y), ImVec2(cmd.clip.z, cmd.clip.w));
+            list->PushTextureID(cmd.texture);
+            list->PrimReserve(cmd.count, 0);
+            for(unsigned k = 0; k < cmd.count; k++) {
+                list->_IdxWritePtr[k] = idx[cmd.offset + k] + base;
+            }
+            list->_IdxWritePtr += cmd.count;
+            list->PopTextureID();
+            list->PopClipRect();
+        }
+    }
+
+    bool currentWindowHidden() {
+        ImGuiContext & g = *GImGui;
+        ImGuiWindow * window = g.CurrentWindow;
+        if(window->SkipItems) return true;
+        ImRect rect = window->Rect();
+        if(!ImRect(ImVec2(0, 0), g.IO.DisplaySize).Overlaps(rect)) return true;
+        // g.Windows is in display order, back to front.
+        for(int i = g.Windows.Size - 1; i >= 0 && g.Windows[i] != window; i--) {
+            ImGuiWindow * other = g.Windows[i];
+            if(other->Hidden || !(other->Active || other->WasActive)) continue;
+            if(other->Flags & (ImGuiWindowFlags_ChildWindow | ImGuiWindowFlags_Tooltip | ImGuiWindowFlags_Popup)) continue;
+            if(other->Rect().Contains(rect)) return true;
+        }
+        return false;
+    }
+
+} // namespace ipip
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <imgui.h>
+#include <vector>
+
+namespace ipip {
+
+    // The draw commands one plot appended to a window's draw list, kept so an
+    // unchanged plot can be replayed without running ImPlot again. Indices
+    // are stored relative to the first captured vertex.
+    struct DrawCache {
+        struct Cmd {
+            ImVec4 clip;
+            ImTextureID texture;
+            unsigned offset;
+            unsigned count;
+        };
+
+        struct Mark {
+            int cmd;
+            int idx;
+            int vtx;
+        };
+
+        bool valid{false};
+        std::vector<ImDrawVert> vtx;
+        std::vector<ImDrawIdx> idx;
+        std::vector<Cmd> cmds;
+
+        // Call before submitting the plot, then capture() after it.
+        static Mark mark(ImDrawList * list);
+        void capture(ImDrawList * list, const Mark & from);
+        void replay(ImDrawList * list) const;
+    };
+
+    // True when the current window is collapsed, off-screen, or completely
+    // covered by a window in front of it, so drawing it is wasted work.
+    bool currentWindowHidden();
+
+} // namespace ipip
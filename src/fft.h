@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ipip {
+
+    enum WindowFunction {
+        WindowRect,
+        WindowHann,
+        WindowHamming,
+        WindowBlackman,
+    };
+
+    // Magnitude spectrum of n real samples (n a power of two) through one n/2
+    // point complex FFT. Real and imaginary parts live in separate arrays and
+    // every stage has its own contiguous twiddles, so the butterfly loops
+    // vectorize without intrinsics. Output bins 0..n/2 are scaled so a sine
+    // of amplitude A peaks at A.
+    struct RealFft {
+        static constexpr double Pi = 3.14159265358979323846;
+        size_t n{0};
+        std::vector<double> window;
+        std::vector<uint32_t> reverse;
+        std::vector<double> twRe, twIm;       // per stage, stage `len` at offset len/2 - 1
+        std::vector<double> splitRe, splitIm; // e^(-2 pi i k / n), k < n/2
+        std::vector<double> re, im;
+        double gain{0};
+
+        static bool valid(size_t n) { return n >= 8 && (n & (n - 1)) == 0; }
+
+        void init(size_t size, WindowFunction func) {
+            n = size;
+            size_t half = n / 2;
+            window.resize(n);
+            double sum = 0;
+            for(size_t i = 0; i < n; i++) {
+                double x = 2 * Pi * i / (n - 1);
+                switch(func) {
+                case WindowHann: window[i] = 0.5 - 0.5 * cos(x); break;
+                case WindowHamming: window[i] = 0.54 - 0.46 * cos(x); break;
+                case WindowBlackman: window[i] = 0.42 - 0.5 * cos(x) + 0.08 * cos(2 * x); break;
+                default: window[i] = 1; break;
+                }
+                sum += window[i];
+            }
+            gain = 2 / sum;
+            int bits = 0;
+            while((size_t(1) << bits) < half) bits++;
+            reverse.resize(half);
+            for(size_t i = 0; i < half; i++) {
+                uint32_t r = 0;
+                for(int b = 0; b < bits; b++) r |= ((i >> b) & 1) << (bits - 1 - b);
+                reverse[i] = r;
+            }
+            twRe.clear();
+            twIm.clear();
+            for(size_t len = 2; len <= half; len <<= 1) {
+                for(size_t j = 0; j < len / 2; j++) {
+                    twRe.push_back(cos(-2 * Pi * j / len));
+                    twIm.push_back(sin(-2 * Pi * j / len));
+                }
+            }
+            splitRe.resize(half);
+            splitIm.resize(half);
+            for(size_t k = 0; k < half; k++) {
+                splitRe[k] = cos(-2 * Pi * k / n);
+                splitIm[k] = sin(-2 * Pi * k / n);
+            }
+            re.resize(half);
+            im.resize(half);
+        }
+
+        // `a` and `b` are the two contiguous pieces of the time-ordered input
+        // (a ring buffer unrolled), `out` receives n/2 + 1 magnitudes.
+        void magnitude(const double * a, size_t na, const double * b, double * out) {
+            size_t half = n / 2;
+            // Even samples become the real part, odd samples the imaginary part.
+            for(size_t k = 0; k < half; k++) {
+                size_t i = 2 * k;
+                double x0 = i < na ? a[i] : b[i - na];
+                double x1 = i + 1 < na ? a[i + 1] : b[i + 1 - na];
+                re[reverse[k]] = x0 * window[i];
+                im[reverse[k]] = x1 * window[i + 1];
+            }
+            for(size_t len = 2; len <= half; len <<= 1) {
+                size_t m = len / 2;
+                const double * wr = twRe.data() + m - 1;
+                const double * wi = twIm.data() + m - 1;
+                for(size_t s = 0; s < half; s += len) {
+                    double * ur = re.data() + s, * ui = im.data() + s;
+                    double * vr = ur + m, * vi = ui + m;
+                    for(size_t j = 0; j < m; j++) {
+                        double tr = vr[j] * wr[j] - vi[j] * wi[j];
+                        double ti = vr[j] * wi[j] + vi[j] * wr[j];
+                        vr[j] = ur[j] - tr;
+                        vi[j] = ui[j] - ti;
+                        ur[j] += tr;
+                        ui[j] += ti;
+                    }
+                }
+            }
+            // X[k] = E[k] + W^k O[k] with E, O the spectra of the even and odd samples.
+            out[0] = fabs(re[0] + im[0]) * gain / 2;
+            out[half] = fabs(re[0] - im[0]) * gain / 2;
+            for(size_t k = 1; k < half; k++) {
+                double ar = re[k], ai = im[k];
+                double br = re[half - k], bi = -im[half - k];
+                double er = (ar + br) / 2, ei = (ai + bi) / 2;
+                double or_ = (ai - bi) / 2, oi = (br - ar) / 2;
+                double xr = er + splitRe[k] * or_ - splitIm[k] * oi;
+                double xi = ei + splitRe[k] * oi + splitIm[k] * or_;
+                out[k] = sqrt(xr * xr + xi * xi) * gain;
+            }
+        }
+    };
+
+} // namespace ipip
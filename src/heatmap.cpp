@@ -1,5 +1,7 @@
 #include<implot.h>
 #include<implot_internal.h>
+#include<array>
+#include<vector>
 
 #ifndef IMPLOT_NO_FORCE_INLINE
     #ifdef _MSC_VER
@@ -62,137 +64,98 @@ namespace ImPlot
     typedef TransformerXY<TransformerLog,TransformerLin> TransformerLogLin;
     typedef TransformerXY<TransformerLog,TransformerLog> TransformerLogLog;
 
-    struct RectInfo {
-        ImPlotPoint Min, Max;
-        ImU32 Color;
-    };
-    
-    template <typename T>
-    struct MaxIdx_ { static const unsigned int Value; };
-    template <> const unsigned int MaxIdx_<unsigned short>::Value = 65535;
-    template <> const unsigned int MaxIdx_<unsigned int>::Value   = 4294967295;
-
-    template <typename TGetter, typename TTransformer>
-    struct RectRenderer {
-        IMPLOT_INLINE RectRenderer(const TGetter& getter, const TTransformer& transformer) :
-            Getter(getter),
-            Transformer(transformer),
-            Prims(Getter.Count)
-        {}
-        IMPLOT_INLINE bool operator()(ImDrawList& DrawList, const ImRect& cull_rect, const ImVec2& uv, int prim) const {
-            RectInfo rect = Getter(prim);
-            ImVec2 P1 = Transformer(rect.Min);
-            ImVec2 P2 = Transformer(rect.Max);
-
-            if ((rect.Color & IM_COL32_A_MASK) == 0 || !cull_rect.Overlaps(ImRect(ImMin(P1, P2), ImMax(P1, P2))))
-                return false;
-
-            DrawList._VtxWritePtr[0].pos   = P1;
-            DrawList._VtxWritePtr[0].uv    = uv;
-            DrawList._VtxWritePtr[0].col   = rect.Color;
-            DrawList._VtxWritePtr[1].pos.x = P1.x;
-            DrawList._VtxWritePtr[1].pos.y = P2.y;
-            DrawList._VtxWritePtr[1].uv    = uv;
-            DrawList._VtxWritePtr[1].col   = rect.Color;
-            DrawList._VtxWritePtr[2].pos   = P2;
-            DrawList._VtxWritePtr[2].uv    = uv;
-            DrawList._VtxWritePtr[2].col   = rect.Color;
-            DrawList._VtxWritePtr[3].pos.x = P2.x;
-            DrawList._VtxWritePtr[3].pos.y = P1.y;
-            DrawList._VtxWritePtr[3].uv    = uv;
-            DrawList._VtxWritePtr[3].col   = rect.Color;
-            DrawList._VtxWritePtr += 4;
-            DrawList._IdxWritePtr[0] = (ImDrawIdx)(DrawList._VtxCurrentIdx);
-            DrawList._IdxWritePtr[1] = (ImDrawIdx)(DrawList._VtxCurrentIdx + 1);
-            DrawList._IdxWritePtr[2] = (ImDrawIdx)(DrawList._VtxCurrentIdx + 3);
-            DrawList._IdxWritePtr[3] = (ImDrawIdx)(DrawList._VtxCurrentIdx + 1);
-            DrawList._IdxWritePtr[4] = (ImDrawIdx)(DrawList._VtxCurrentIdx + 2);
-            DrawList._IdxWritePtr[5] = (ImDrawIdx)(DrawList._VtxCurrentIdx + 3);
-            DrawList._IdxWritePtr   += 6;
-            DrawList._VtxCurrentIdx += 4;
-            return true;
+    // 256 entry color table per colormap, built on first use. Colormaps never
+    // change once registered, so the tables stay valid for the whole run.
+    static const ImU32* ColormapLut(ImPlotColormap cmap) {
+        static std::vector<std::array<ImU32, 256>> luts;
+        static std::vector<bool> built;
+        if (cmap >= (int)luts.size()) {
+            luts.resize(cmap + 1);
+            built.resize(cmap + 1, false);
         }
-        const TGetter& Getter;
-        const TTransformer& Transformer;
-        const int Prims;
-        static const int IdxConsumed = 6;
-        static const int VtxConsumed = 4;
-    };
-
-
-    template <typename Renderer>
-    IMPLOT_INLINE void RenderPrimitives(const Renderer& renderer, ImDrawList& DrawList, const ImRect& cull_rect) {
-        unsigned int prims        = renderer.Prims;
-        unsigned int prims_culled = 0;
-        unsigned int idx          = 0;
-        const ImVec2 uv = DrawList._Data->TexUvWhitePixel;
-        while (prims) {
-            // find how many can be reserved up to end of current draw command's limit
-            unsigned int cnt = ImMin(prims, (MaxIdx_<ImDrawIdx>::Value - DrawList._VtxCurrentIdx) / Renderer::VtxConsumed);
-            // make sure at least this many elements can be rendered to avoid situations where at the end of buffer this slow path is not taken all the time
-            if (cnt >= ImMin(64u, prims)) {
-                if (prims_culled >= cnt)
-                    prims_culled -= cnt; // reuse previous reservation
-                else {
-                    DrawList.PrimReserve((cnt - prims_culled) * Renderer::IdxConsumed, (cnt - prims_culled) * Renderer::VtxConsumed); // add more elements to previous reservation
-                    prims_culled = 0;
-                }
-            }
-            else
-            {
-                if (prims_culled > 0) {
-                    DrawList.PrimUnreserve(prims_culled * Renderer::IdxConsumed, prims_culled * Renderer::VtxConsumed);
-                    prims_culled = 0;
-                }
-                cnt = ImMin(prims, (MaxIdx_<ImDrawIdx>::Value - 0/*DrawList._VtxCurrentIdx*/) / Renderer::VtxConsumed);
-                DrawList.PrimReserve(cnt * Renderer::IdxConsumed, cnt * Renderer::VtxConsumed); // reserve new draw command
-            }
-            prims -= cnt;
-            for (unsigned int ie = idx + cnt; idx != ie; ++idx) {
-                if (!renderer(DrawList, cull_rect, uv, idx))
-                    prims_culled++;
-            }
+        if (!built[cmap]) {
+            for (int i = 0; i < 256; ++i)
+                luts[cmap][i] = GImPlot->ColormapData.LerpTable(cmap, i / 255.0f);
+            built[cmap] = true;
         }
-        if (prims_culled > 0)
-            DrawList.PrimUnreserve(prims_culled * Renderer::IdxConsumed, prims_culled * Renderer::VtxConsumed);
+        return luts[cmap].data();
     }
 
+    // Maps n values to LUT indices in one branch-free pass, which compilers
+    // turn into packed SIMD at -O2/-O3.
     template <typename T>
-    struct GetterHeatmapTranspose {
-        GetterHeatmapTranspose(const T* values, int rows, int cols, double scale_min, double scale_max, double width, double height, double xref, double yref, double ydir) :
-            Values(values),
-            Count(rows*cols),
-            Rows(rows),
-            Cols(cols),
-            ScaleMin(scale_min),
-            ScaleMax(scale_max),
-            Width(width),
-            Height(height),
-            XRef(xref),
-            YRef(yref),
-            YDir(ydir),
-            HalfSize(Width*0.5, Height*0.5)
-        { }
+    IMPLOT_INLINE void QuantizeColumn(const T* values, int n, double scale_min, double scale_max, int* out) {
+        const float k = (float)(255.0 / (scale_max - scale_min));
+        for (int i = 0; i < n; ++i) {
+            float t = (float)((double)values[i] - scale_min) * k + 0.5f;
+            // Written so NaN fails the test and becomes 0, keeping the cast defined.
+            t = !(t >= 0.0f) ? 0.0f : t;
+            t = t > 255.0f ? 255.0f : t;
+            out[i] = (int)t;
+        }
+    }
 
-        template <typename I> IMPLOT_INLINE RectInfo operator()(I idx) const {
-            double val = (double)Values[idx];
-            const int r = idx % Rows;
-            const int c = idx / Rows;
-            const ImPlotPoint p(XRef + HalfSize.x + c*Width, YRef + YDir * (HalfSize.y + r*Height));
-            RectInfo rect;
-            rect.Min.x = p.x - HalfSize.x;
-            rect.Min.y = p.y - HalfSize.y;
-            rect.Max.x = p.x + HalfSize.x;
-            rect.Max.y = p.y + HalfSize.y;
-            const float t = ImClamp((float)ImRemap01(val, ScaleMin, ScaleMax),0.0f,1.0f);
-            rect.Color = GImPlot->ColormapData.LerpTable(GImPlot->Style.Colormap, t);
-            return rect;
+    // Emits the heatmap cells column by column, in memory order. Pixel edges of
+    // every row and column are transformed once up front, so the inner loop has
+    // no division, no modulo and no per-cell colormap lookup through GImPlot.
+    template <typename T, typename Transformer>
+    void RenderHeatmapCells(const Transformer& transformer, ImDrawList& DrawList, const T* values, int rows, int cols, double scale_min, double scale_max, const ImPlotPoint& bounds_min, const ImPlotPoint& bounds_max, double yref, double ydir, const ImRect& cull_rect) {
+        const double w = (bounds_max.x - bounds_min.x) / cols;
+        const double h = (bounds_max.y - bounds_min.y) / rows;
+        static std::vector<float> x_lo, x_hi, y_lo, y_hi;
+        static std::vector<int> idx;
+        x_lo.resize(cols); x_hi.resize(cols);
+        y_lo.resize(rows); y_hi.resize(rows);
+        idx.resize(rows);
+        for (int c = 0; c < cols; ++c) {
+            x_lo[c] = transformer.Tx(bounds_min.x + c * w);
+            x_hi[c] = transformer.Tx(bounds_min.x + (c + 1) * w);
         }
-        const T* const Values;
-        const int Count, Rows, Cols;
-        const double ScaleMin, ScaleMax, Width, Height, XRef, YRef, YDir;
-        const ImPlotPoint HalfSize;
-    };
+        int r_begin = rows, r_end = 0;
+        for (int r = 0; r < rows; ++r) {
+            const double cy = yref + ydir * (0.5 * h + r * h);
+            y_lo[r] = transformer.Ty(cy - 0.5 * h);
+            y_hi[r] = transformer.Ty(cy + 0.5 * h);
+            if (ImMax(y_lo[r], y_hi[r]) >= cull_rect.Min.y && ImMin(y_lo[r], y_hi[r]) <= cull_rect.Max.y) {
+                r_begin = ImMin(r_begin, r);
+                r_end = r + 1;
+            }
+        }
+        if (r_begin >= r_end)
+            return;
+        const int n = r_end - r_begin;
+        const ImU32* lut = ColormapLut(GImPlot->Style.Colormap);
+        const ImVec2 uv = DrawList._Data->TexUvWhitePixel;
+        for (int c = 0; c < cols; ++c) {
+            if (ImMax(x_lo[c], x_hi[c]) < cull_rect.Min.x || ImMin(x_lo[c], x_hi[c]) > cull_rect.Max.x)
+                continue;
+            QuantizeColumn(values + (size_t)c * rows + r_begin, n, scale_min, scale_max, idx.data());
+            DrawList.PrimReserve(n * 6, n * 4);
+            ImDrawVert* vtx = DrawList._VtxWritePtr;
+            ImDrawIdx* ind = DrawList._IdxWritePtr;
+            unsigned int base = DrawList._VtxCurrentIdx;
+            for (int i = 0; i < n; ++i) {
+                const int r = r_begin + i;
+                const ImU32 col = lut[idx[i]];
+                vtx[0].pos.x = x_lo[c]; vtx[0].pos.y = y_lo[r]; vtx[0].uv = uv; vtx[0].col = col;
+                vtx[1].pos.x = x_lo[c]; vtx[1].pos.y = y_hi[r]; vtx[1].uv = uv; vtx[1].col = col;
+                vtx[2].pos.x = x_hi[c]; vtx[2].pos.y = y_hi[r]; vtx[2].uv = uv; vtx[2].col = col;
+                vtx[3].pos.x = x_hi[c]; vtx[3].pos.y = y_lo[r]; vtx[3].uv = uv; vtx[3].col = col;
+                ind[0] = (ImDrawIdx)(base);
+                ind[1] = (ImDrawIdx)(base + 1);
+                ind[2] = (ImDrawIdx)(base + 3);
+                ind[3] = (ImDrawIdx)(base + 1);
+                ind[4] = (ImDrawIdx)(base + 2);
+                ind[5] = (ImDrawIdx)(base + 3);
+                vtx += 4;
+                ind += 6;
+                base += 4;
+            }
+            DrawList._VtxWritePtr = vtx;
+            DrawList._IdxWritePtr = ind;
+            DrawList._VtxCurrentIdx = base;
+        }
+    }
 
     template <typename T, typename Transformer>
     void RenderHeatmapTranspose(Transformer transformer, ImDrawList& DrawList, const T* values, int rows, int cols, double scale_min, double scale_max, const char* fmt, const ImPlotPoint& bounds_min, const ImPlotPoint& bounds_max, bool reverse_y) {
@@ -212,13 +175,7 @@ namespace ImPlot
         }
         const double yref = reverse_y ? bounds_max.y : bounds_min.y;
         const double ydir = reverse_y ? -1 : 1;
-        GetterHeatmapTranspose<T> getter(values, rows, cols, scale_min, scale_max, (bounds_max.x - bounds_min.x) / cols, (bounds_max.y - bounds_min.y) / rows, bounds_min.x, yref, ydir);
-        switch (GetCurrentScale()) {
-            case ImPlotScale_LinLin: RenderPrimitives(RectRenderer<GetterHeatmapTranspose<T>, TransformerLinLin>(getter, TransformerLinLin()), DrawList, gp.CurrentPlot->PlotRect); break;
-            case ImPlotScale_LogLin: RenderPrimitives(RectRenderer<GetterHeatmapTranspose<T>, TransformerLogLin>(getter, TransformerLogLin()), DrawList, gp.CurrentPlot->PlotRect); break;;
-            case ImPlotScale_LinLog: RenderPrimitives(RectRenderer<GetterHeatmapTranspose<T>, TransformerLinLog>(getter, TransformerLinLog()), DrawList, gp.CurrentPlot->PlotRect); break;;
-            case ImPlotScale_LogLog: RenderPrimitives(RectRenderer<GetterHeatmapTranspose<T>, TransformerLogLog>(getter, TransformerLogLog()), DrawList, gp.CurrentPlot->PlotRect); break;;
-        }
+        RenderHeatmapCells(transformer, DrawList, values, rows, cols, scale_min, scale_max, bounds_min, bounds_max, yref, ydir, gp.CurrentPlot->PlotRect);
         if (fmt != NULL) {
             const double w = (bounds_max.x - bounds_min.x) / cols;
             const double h = (bounds_max.y - bounds_min.y) / rows;
@@ -261,6 +218,24 @@ namespace ImPlot
         }
     }
 
+    void PlotHeatmapImage(const char* label_id, ImTextureID texture, double v0, double v1, const ImPlotPoint& bounds_min, const ImPlotPoint& bounds_max) {
+        if (BeginItem(label_id)) {
+            if (FitThisFrame()) {
+                FitPoint(bounds_min);
+                FitPoint(bounds_max);
+            }
+            ImDrawList& DrawList = *GetPlotDrawList();
+            ImVec2 p1 = PlotToPixels(bounds_min.x, bounds_min.y);
+            ImVec2 p2 = PlotToPixels(bounds_max.x, bounds_min.y);
+            ImVec2 p3 = PlotToPixels(bounds_max.x, bounds_max.y);
+            ImVec2 p4 = PlotToPixels(bounds_min.x, bounds_max.y);
+            PushPlotClipRect();
+            DrawList.AddImageQuad(texture, p1, p2, p3, p4, ImVec2(0, (float)v0), ImVec2(0, (float)v1), ImVec2(1, (float)v1), ImVec2(1, (float)v0));
+            PopPlotClipRect();
+            EndItem();
+        }
+    }
+
     template IMPLOT_API void PlotHeatmapTranspose<ImS8>(const char* label_id, const ImS8* values, int rows, int cols, double scale_min, double scale_max, const char* fmt, const ImPlotPoint& bounds_min, const ImPlotPoint& bounds_max);
     template IMPLOT_API void PlotHeatmapTranspose<ImU8>(const char* label_id, const ImU8* values, int rows, int cols, double scale_min, double scale_max, const char* fmt, const ImPlotPoint& bounds_min, const ImPlotPoint& bounds_max);
     template IMPLOT_API void PlotHeatmapTranspose<ImS16>(const char* label_id, const ImS16* values, int rows, int cols, double scale_min, double scale_max, const char* fmt, const ImPlotPoint& bounds_min, const ImPlotPoint& bounds_max);
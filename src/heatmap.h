@@ -2,4 +2,10 @@
 
 namespace ImPlot{
     template <typename T> IMPLOT_API void PlotHeatmapTranspose(const char* label_id, const T* values, int rows, int cols, double scale_min=0, double scale_max=0, const char* label_fmt="%.1f", const ImPlotPoint& bounds_min=ImPlotPoint(0,0), const ImPlotPoint& bounds_max=ImPlotPoint(1,1));
-}
\ No newline at end of file
+}
+namespace ImPlot{
+    // Draws a heatmap texture holding one texel row per sample as a single quad:
+    // texture rows [v0, v1) (in texture coordinates, wrapping) span bounds_min.x
+    // to bounds_max.x and texel columns span bounds_min.y to bounds_max.y.
+    IMPLOT_API void PlotHeatmapImage(const char* label_id, ImTextureID texture, double v0, double v1, const ImPlotPoint& bounds_min, const ImPlotPoint& bounds_max);
+}
@@ -2,7 +2,9 @@
 #include <imgui.h>
 #include <implot.h>
 #include <vector>
+#include <deque>
 #include <cmath>
+#include <cstring>
 #include <memory>
 #include <map>
 #include <string>
@@ -11,10 +13,26 @@
 #include <ctime>
 #include <iterator>
 #include <iostream>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <GLFW/glfw3.h>
 #include "help.h"
 #include "server.h"
 #include "heatmap.h"
+#include "sample.h"
+#include "storage.h"
+#include "lod.h"
+#include "pyramid.h"
+#include "stats.h"
+#include "texture.h"
+#include "record.h"
+#include "metrics.h"
+#include "drawcache.h"
+#include "derive.h"
+#include "snapshot.h"
+#include "relay.h"
+#include "compress.h"
 
 namespace ipip {
 
@@ -23,6 +41,14 @@ namespace ipip {
         int colormap = 5;
         bool lock_x = true;
         bool show_perf = false;
+        bool scroll = false;
+        bool gpu_heatmap = true;
+        float ingest_budget = 8;
+        int overflow = OverflowReject;
+        float max_fps = 60;
+        float idle_rate = 2;
+        bool compress = false;
+        float keep = 600;
     } option;
 
     struct Events{
@@ -31,93 +57,499 @@ namespace ipip {
         bool tile_window = false;
     } event;
 
+    // Where samples land on the X axis. Sweep mode redraws over the previous
+    // sweep like an oscilloscope, scroll mode keeps `now` at the right edge.
+    struct TimeView {
+        double now;
+        double span;
+
+        double minX() const { return option.scroll ? now - span : 0; }
+        double maxX() const { return option.scroll ? now : span; }
+
+        template<class F> void ranges(const RingStore & store, F f) const {
+            if(store.empty()) return;
+            size_t begin = store.lowerBound(now - span);
+            if(option.scroll) {
+                f(begin, store.size(), 0.0);
+                return;
+            }
+            double base = floor(now / span) * span;
+            size_t mid = store.lowerBound(base);
+            f(begin, mid, span - base);
+            f(mid, store.size(), -base);
+        }
+    };
+
+    struct LineView {
+        const RingStore * store;
+        size_t begin;
+        double shift;
+
+        static ImPlotPoint get(void * data, int idx) {
+            auto & view = *(LineView *)data;
+            size_t row = view.begin + idx;
+            return ImPlotPoint(view.store->timeAt(row) + view.shift, view.store->valueAt(row)[0]);
+        }
+    };
+
     struct Stream {
-        float span{60};
         int width{1};
         double vmx{-1e100}, vmn{1e100};
         std::string name{};
-        std::vector<double> data;
-        std::vector<double> tickmod;
-        std::vector<double> buffer;
+        RingStore store;
+        HeatTexture texture;
+        M4Cache lod;
+        std::vector<double> lodX, lodY;
+        size_t lodSplit{0};
+        bool lodScroll{false};
+        double lodLimits[2]{0, 0};
+        // Started the first time a scrolling view reaches past the ring.
+        std::unique_ptr<HistoryPyramid> pyramid;
+        std::vector<double> pyrX, pyrMin, pyrMax, pyrMean;
+        // Over the last `history` seconds; vmn/vmx above are all-time.
+        RollingStats stats;
+        double heatScale[2]{0, 0};
+        // Only while GET /data reads this stream.
+        std::unique_ptr<StreamMirror> mirror;
+        // Optional Gorilla-coded history of scalar streams. It then holds
+        // the last `keep` (at least `history`) seconds and the ring above
+        // only a small uncompressed head for plotting recent rows.
+        std::unique_ptr<CompressedSeries> archive;
+        M4Cache archLod, archHead;
+        uint64_t archSealed{0};
+        std::vector<double> archX, archY;
 
         Stream(std::string name): name{name}{}
 
-        void updateBuffer(double time) {
-            span = option.history;
-            if (!tickmod.empty() && fmod(time, span) < tickmod.back()) {
-                tickmod.resize(0);
-                data.resize(0);
-            }
-            tickmod.push_back(fmod(time, span));
+        bool archived() const { return archive && width == 1; }
+
+        // Rows kept, wherever they are stored.
+        size_t stored() const { return archived() ? archive->rows() : store.size(); }
+
+        // Whether rows were discarded, so that zooming out needs the pyramid.
+        bool dropped() const { return (archived() ? archive->rows() : store.size()) < store.pushed; }
+
+        // Oldest time GET /data serves.
+        double historyFront() const {
+            return archived() && !archive->empty() ? archive->back() - option.history : store.front();
         }
 
-        void plotLine() {
-            ImPlot::PlotLine(name.c_str(), tickmod.data(), data.data(), tickmod.size(), 0, sizeof(double));
+        void plotLine(const TimeView & view) {
+            ImPlotLimits limits = ImPlot::GetPlotLimits();
+            double pixels = std::max(1.0f, ImPlot::GetPlotSize().x);
+            double lo = option.scroll ? limits.X.Min : view.now - view.span;
+            if(!store.empty() && lo < store.front()) {
+                bool older = archived() && !archive->empty() && archive->front() < store.front();
+                bool tiers = option.scroll && width == 1 && (pyramid || dropped());
+                if(older && (!tiers || archive->front() <= lo)) {
+                    plotLineArchive(view, limits, pixels);
+                    return;
+                }
+                if(tiers) {
+                    if(!pyramid) startPyramid();
+                    if(!pyramid->empty()) {
+                        plotLineHistory(limits, pixels);
+                        return;
+                    }
+                }
+            }
+            if(store.size() - store.lowerBound(lo) > 4 * pixels) {
+                plotLineLod(view, limits, pixels);
+                return;
+            }
+            if(option.scroll) {
+                // From the last row left of the view, so the line enters it.
+                size_t begin = store.lowerBound(lo);
+                LineView line{&store, begin > 0 ? begin - 1 : 0, 0};
+                ImPlot::PlotLineG(name.c_str(), LineView::get, &line, store.size() - line.begin);
+                return;
+            }
+            view.ranges(store, [&](size_t begin, size_t end, double shift) {
+                LineView line{&store, begin, shift};
+                if(end > begin) ImPlot::PlotLineG(name.c_str(), LineView::get, &line, end - begin);
+            });
         }
 
-        void plotHeat(float &scale_min, float &scale_max) {
-            if(data.size() > buffer.size()) {
-                buffer.resize(data.size());
+        // Plots one first/min/max/last quad per pixel column instead of every sample.
+        void plotLineLod(const TimeView & view, const ImPlotLimits & limits, double pixels) {
+            double bucket = (limits.X.Max - limits.X.Min) / pixels;
+            double lo = option.scroll ? limits.X.Min : view.now - view.span;
+            bool changed = lod.update(store, lo, bucket);
+            if(changed || lodScroll != option.scroll || lodLimits[0] != limits.X.Min || lodLimits[1] != limits.X.Max) {
+                lodScroll = option.scroll;
+                lodLimits[0] = limits.X.Min;
+                lodLimits[1] = limits.X.Max;
+                lodX.clear();
+                lodY.clear();
+                if(option.scroll) {
+                    lod.emit(limits.X.Min, limits.X.Max + bucket, 0, lodX, lodY);
+                    lodSplit = lodX.size();
+                }
+                else {
+                    double base = floor(view.now / view.span) * view.span;
+                    lod.emit(lo, base, view.span - base, lodX, lodY);
+                    lodSplit = lodX.size();
+                    lod.emit(base + lod.width, view.now + lod.width, -base, lodX, lodY);
+                }
+            }
+            if(lodSplit > 0) {
+                ImPlot::PlotLine(name.c_str(), lodX.data(), lodY.data(), lodSplit);
+            }
+            if(lodX.size() > lodSplit) {
+                ImPlot::PlotLine(name.c_str(), lodX.data() + lodSplit, lodY.data() + lodSplit, lodX.size() - lodSplit);
             }
-            ImPlot::PlotHeatmapTranspose(name.c_str(), data.data(), width, data.size() / width, vmn, vmx,
-                "", ImPlotPoint(tickmod.size() ? tickmod.front() : 0, 1), ImPlotPoint(tickmod.size() ? tickmod.back() : 0, 0));
         }
 
-        void feed(double time, const std::vector<double> & value) {
-            updateBuffer(time);
-            width = value.size();
-            for(auto v: value) {
-                vmx = std::max(vmx, v);
-                vmn = std::min(vmn, v);
+        // Zoomed out past the ring: draws the min/max band and the mean of
+        // the history tier matching the visible range.
+        void plotLineHistory(const ImPlotLimits & limits, double pixels) {
+            auto & tier = pyramid->pick(limits.X.Min, limits.X.Max, 2 * pixels);
+            pyrX.clear();
+            pyrMin.clear();
+            pyrMax.clear();
+            pyrMean.clear();
+            pyramid->emit(tier, limits.X.Min, limits.X.Max, pyrX, pyrMin, pyrMax, pyrMean);
+            if(pyrX.empty()) return;
+            ImPlot::PushStyleVar(ImPlotStyleVar_FillAlpha, 0.25f);
+            ImPlot::PlotShaded(name.c_str(), pyrX.data(), pyrMin.data(), pyrMax.data(), pyrX.size());
+            ImPlot::PopStyleVar();
+            ImPlot::PlotLine(name.c_str(), pyrX.data(), pyrMean.data(), pyrX.size());
+        }
+
+        // Past the ring head with an archive: decodes only the blocks in
+        // view into per-pixel buckets, then folds in newly sealed blocks as
+        // long as the bucket width holds. The head is folded every frame.
+        void plotLineArchive(const TimeView & view, const ImPlotLimits & limits, double pixels) {
+            double bucket = (limits.X.Max - limits.X.Min) / pixels;
+            double from = option.scroll ? limits.X.Min : view.now - view.span;
+            double lo = std::floor(from / bucket) * bucket;
+            size_t unfolded = archive->sealed - archSealed;
+            if(archLod.buckets.empty() || std::abs(bucket - archLod.width) > 1e-6 * bucket || lo < archLod.lo
+                || unfolded > archive->blocks.size()) {
+                archLod.buckets.clear();
+                archLod.width = bucket;
+                unfolded = archive->blocks.size();
+            }
+            archive->scan(archive->blocks.size() - unfolded, lo, INFINITY, [&](const double * t, const double * v, size_t n) {
+                for(size_t i = 0; i < n; i++) {
+                    if(t[i] >= lo) archLod.add(t[i], v[i]);
+                }
+            });
+            archSealed = archive->sealed;
+            archLod.lo = lo;
+            while(!archLod.buckets.empty() && (archLod.buckets.front().key + 1) * bucket < from) {
+                archLod.buckets.pop_front();
+            }
+            archHead.buckets.clear();
+            archHead.width = bucket;
+            for(size_t i = 0; i < archive->headTime.size(); i++) {
+                if(archive->headTime[i] >= lo) archHead.add(archive->headTime[i], archive->headValue[i]);
+            }
+            archX.clear();
+            archY.clear();
+            auto emit = [&](double lo, double hi, double shift) {
+                archLod.emit(lo, hi, shift, archX, archY);
+                archHead.emit(lo, hi, shift, archX, archY);
+            };
+            size_t split;
+            if(option.scroll) {
+                emit(limits.X.Min, limits.X.Max + bucket, 0);
+                split = archX.size();
+            }
+            else {
+                double base = floor(view.now / view.span) * view.span;
+                emit(from, base, view.span - base);
+                split = archX.size();
+                emit(base + bucket, view.now + bucket, -base);
+            }
+            if(split > 0) {
+                ImPlot::PlotLine(name.c_str(), archX.data(), archY.data(), split);
+            }
+            if(archX.size() > split) {
+                ImPlot::PlotLine(name.c_str(), archX.data() + split, archY.data() + split, archX.size() - split);
             }
-            std::copy(value.begin(), value.end(), std::back_inserter(data));
         }
 
-        void feed(double time, double value) {
-            std::vector<double> data{value};
-            feed(time, data);
+        // Seeds the tiers from the rows already kept.
+        void startPyramid() {
+            pyramid = std::make_unique<HistoryPyramid>(option.keep);
+            if(archived() && !archive->empty()) {
+                archive->each(archive->front(), [&](double time, double value) { pyramid->add(time, value); });
+                return;
+            }
+            for(size_t i = 0; i < store.size(); i++) pyramid->add(store.timeAt(i), store.valueAt(i)[0]);
         }
 
-        void feed(double time, Json::Value value) {
-            ipipAssert(value.isArray() || value.isNumeric(), "Invalid data", value);
-            std::vector<double> _value;
-            if(value.isArray()) {
-                for(int i = 0; i < value.size(); i++) {
-                    _value.push_back(value[i].asDouble());
+        void setArchive(bool on) {
+            archLod.buckets.clear();
+            if(!on) {
+                if(archived() && !archive->empty()) {
+                    // The ring only held the head; refill it from the archive.
+                    store.reset(width);
+                    archive->each(archive->back() - option.history, [&](double time, double value) {
+                        store.push(time, &value, option.history);
+                    });
                 }
+                archive.reset();
+                return;
+            }
+            archive = std::make_unique<CompressedSeries>();
+            if(width != 1) return;
+            for(size_t i = 0; i < store.size(); i++) archive->push(store.timeAt(i), store.valueAt(i)[0]);
+        }
+
+        void showArchive() {
+            bool on = archive != nullptr;
+            if(ImGui::Checkbox("Compressed history", &on)) setArchive(on);
+            if(archive && !archive->empty()) {
+                ImGui::Text("%zu samples, %.1f KiB, %.2f bytes/sample", archive->rows(), archive->bytes() / 1024.0,
+                    (double)archive->bytes() / archive->rows());
             }
-            else if(value.isNumeric()) {
-                _value.push_back(value.asDouble());
+        }
+
+        // Follows the windowed extremes, but only shrinks once the range
+        // dropped by a fifth so the texture is not recolored all the time.
+        void updateHeatScale() {
+            if(stats.empty()) return;
+            double lo = stats.min(), hi = stats.max();
+            if(lo < heatScale[0] || hi > heatScale[1] || hi - lo < 0.8 * (heatScale[1] - heatScale[0])) {
+                heatScale[0] = lo;
+                heatScale[1] = hi;
+            }
+        }
+
+        void plotHeat(const TimeView & view, float &scale_min, float &scale_max) {
+            updateHeatScale();
+            double lo = heatScale[0], hi = heatScale[1];
+            size_t visible = store.size() - store.lowerBound(view.now - view.span);
+            if(option.gpu_heatmap && visible <= HeatTexture::MaxRows && texture.sync(store, visible, lo, hi, option.colormap)) {
+                view.ranges(store, [&](size_t begin, size_t end, double shift) {
+                    if(end > begin) {
+                        texture.plot(name.c_str(), store, begin, end, store.timeAt(begin) + shift, store.timeAt(end - 1) + shift);
+                    }
+                });
+                return;
+            }
+            view.ranges(store, [&](size_t begin, size_t end, double shift) {
+                store.segments(begin, end, [&](const double * time, const double * value, size_t n) {
+                    ImPlot::PlotHeatmapTranspose(name.c_str(), value, width, n, lo, hi,
+                        nullptr, ImPlotPoint(time[0] + shift, 1), ImPlotPoint(time[n - 1] + shift, 0));
+                });
+            });
+        }
+
+        void feed(double time, const double * value, size_t count) {
+            if((int)count != width || store.capacity() == 0) {
+                width = count;
+                store.reset(width);
+                pyramid.reset();
+                stats.clear();
+                if(mirror) mirror->clear();
+                if(archive) archive->clear();
+                archLod.buckets.clear();
+            }
+            if(archived()) {
+                archive->push(time, value[0]);
+                archive->trim(time - std::max(option.keep, option.history));
+            }
+            // With an archive the ring keeps one or two chunks of recent rows.
+            store.push(time, value, archived() ? 0 : option.history);
+            if(pyramid && pyramid->keep != option.keep) pyramid.reset();
+            if(pyramid) pyramid->add(time, value[0]);
+            stats.add(time, value, count, option.history);
+            if(mirror) {
+                mirror->push(time, value, width);
+                mirror->trim(historyFront());
+            }
+            for(size_t i = 0; i < count; i++) {
+                vmx = std::max(vmx, value[i]);
+                vmn = std::min(vmn, value[i]);
+            }
+        }
+
+        void showStats() const {
+            if(stats.empty()) return;
+            ImGui::BeginTooltip();
+            ImGui::Text("%s, last %.1f s", name.c_str(), option.history);
+            if(width == 1) {
+                ImGui::Text("samples %zu", stats.count());
+                ImGui::Text("mean    %g", stats.mean());
+                ImGui::Text("std     %g", stats.stddev());
+                ImGui::Text("rms     %g", stats.rms());
+                ImGui::Text("p50     %g", stats.quantile(0.5));
+                ImGui::Text("p99     %g", stats.quantile(0.99));
+            }
+            ImGui::Text("min     %g", stats.min());
+            ImGui::Text("max     %g", stats.max());
+            ImGui::EndTooltip();
+        }
+
+        size_t memoryBytes() const {
+            size_t bytes = store.bytes() + (lodX.capacity() + lodY.capacity()) * sizeof(double);
+            bytes += lod.buckets.size() * sizeof(M4Cache::Bucket);
+            if(pyramid) {
+                for(auto & tier: pyramid->tiers) bytes += tier.buckets.capacity() * sizeof(HistoryPyramid::Bucket);
+            }
+            bytes += (stats.window.items.capacity() + stats.maxq.items.capacity() + stats.minq.items.capacity()) * sizeof(RollingStats::Entry);
+            if(mirror) bytes += mirror->memoryBytes();
+            if(archive) bytes += archive->bytes() + (archX.capacity() + archY.capacity()) * sizeof(double)
+                + (archLod.buckets.size() + archHead.buckets.size()) * sizeof(M4Cache::Bucket);
+            return bytes;
+        }
+
+        void feed(double time, double value) {
+            feed(time, &value, 1);
+        }
+
+        void attachMirror() {
+            mirror = std::make_unique<StreamMirror>();
+            if(archived() && !archive->empty()) {
+                archive->each(historyFront(), [&](double time, double value) { mirror->push(time, &value, 1); });
+                return;
             }
-            feed(time, _value);
+            for(size_t i = 0; i < store.size(); i++) mirror->push(store.timeAt(i), store.valueAt(i), width);
+        }
+    };
+
+    // Everything a subplot's plot depends on apart from ImGui input.
+    struct PlotKey {
+        uint64_t version;
+        double now;
+        double range[2];
+        float history;
+        int colormap;
+        float scale[2];
+        float pos[2];
+        float size[2];
+        bool scroll;
+        bool lock_x;
+
+        bool operator==(const PlotKey & o) const {
+            return version == o.version && now == o.now && range[0] == o.range[0] && range[1] == o.range[1]
+                && history == o.history && colormap == o.colormap
+                && scale[0] == o.scale[0] && scale[1] == o.scale[1] && pos[0] == o.pos[0] && pos[1] == o.pos[1]
+                && size[0] == o.size[0] && size[1] == o.size[1] && scroll == o.scroll && lock_x == o.lock_x;
         }
     };
 
     struct Subplot {
+        uint32_t id;
         std::string name;
         bool stream_changed;
+        bool bust_colors{false};
         float scale[2]{0,0};
-        std::vector<Stream> streams;
-        Subplot(std::string name): name{name}, stream_changed{false}{};
-        Stream & findStream(std::string name) {
-            for(auto & stream: streams)
-                if(stream.name == name)
-                    return stream;
-            streams.emplace_back(name);
-            stream_changed = true;
-            return streams.back();
+        // Bumped by feedData; the cache holds the plot drawn for `key`.
+        uint64_t version{0};
+        // Newest sample of this subplot, which its time axis follows.
+        double latest{0};
+        PlotKey key{};
+        DrawCache cache;
+        std::deque<Stream> streams;
+        std::vector<Stream *> streamSlot;
+        Subplot(uint32_t id, std::string name): id{id}, name{name}, stream_changed{false}{};
+        Stream & findStream(uint32_t stream) {
+            if(stream >= streamSlot.size()) streamSlot.resize(stream + 1, nullptr);
+            if(!streamSlot[stream]) {
+                streams.emplace_back(streamName(id, stream));
+                streamSlot[stream] = &streams.back();
+                if(option.compress) streams.back().setArchive(true);
+                stream_changed = true;
+            }
+            return *streamSlot[stream];
+        }
+    };
+
+    // Deques keep Subplot and Stream addresses stable as figures appear, so
+    // the id -> slot tables can hold plain pointers.
+    static std::deque<Subplot> figure;
+    static std::vector<Subplot *> subplotSlot;
+    // Stored times are relative to the first sample.
+    static double timeOrigin = NAN;
+    // Batches popped from the server queue; records before ingestRecord of
+    // ingestBatches[ingestNext] and all earlier batches are already fed.
+    static std::vector<SampleBatch> ingestBatches;
+    static size_t ingestNext = 0;
+    static size_t ingestRecord = 0;
+
+    size_t ingestBacklog() {
+        return ingestBatches.size() - ingestNext;
+    }
+
+    void clearFigure() {
+        figure.clear();
+        subplotSlot.clear();
+        timeOrigin = NAN;
+        clearSnapshots();
+    }
+
+    void releaseGraphics() {
+        for(auto & subp: figure) {
+            for(auto & stream: subp.streams) stream.texture.release();
         }
+        HeatTexture::contextLost();
+    }
+
+    // ipip.dat holds this header and the raw Options. Bump the version when
+    // a field changes meaning; a file from another layout is ignored.
+    struct OptionsHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t size;
     };
+    const uint32_t OptionsVersion = 2;
+    // Off for benchmarks, which run on the built-in defaults.
+    static bool persistOptions = true;
+
+    void loadOptions() {
+        if(!persistOptions) return;
+        if(FILE * f = fopen("ipip.dat", "rb")) {
+            OptionsHeader header;
+            Options loaded;
+            if(fread(&header, sizeof(header), 1, f) == 1 && memcmp(header.magic, "IPIP", 4) == 0
+                && header.version == OptionsVersion && header.size == sizeof(Options) && fread(&loaded, sizeof(loaded), 1, f) == 1) {
+                option = loaded;
+            }
+            fclose(f);
+        }
+    }
+
+    void saveOptions() {
+        if(!persistOptions) return;
+        if(FILE * f = fopen("ipip.dat", "wb")) {
+            OptionsHeader header{{'I', 'P', 'I', 'P'}, OptionsVersion, sizeof(Options)};
+            fwrite(&header, sizeof(header), 1, f);
+            fwrite(&option, sizeof(option), 1, f);
+            fclose(f);
+        }
+    }
+
+    void useDefaultOptions() {
+        persistOptions = false;
+        option = Options{};
+    }
+
+    Json::Value optionsJson() {
+        Json::Value o;
+        o["history"] = option.history;
+        o["colormap"] = option.colormap;
+        o["lock_x"] = option.lock_x;
+        o["show_perf"] = option.show_perf;
+        o["scroll"] = option.scroll;
+        o["gpu_heatmap"] = option.gpu_heatmap;
+        o["ingest_budget"] = option.ingest_budget;
+        o["overflow"] = option.overflow;
+        o["max_fps"] = option.max_fps;
+        o["idle_rate"] = option.idle_rate;
+        o["compress"] = option.compress;
+        o["keep"] = option.keep;
+        return o;
+    }
 
-    static std::vector<Subplot> figure;
     void showSettings() {
         static bool firstRun = true;
         static Options lastoption = option;
         if(firstRun) {
-            if(FILE * f = fopen("ipip.dat", "r")) {
-                fread(&option, sizeof(option), 1, f);
-                fclose(f);
-            }
+            loadOptions();
         }
         firstRun = false;
         ImGui::SetNextWindowPos(ImVec2(50, 50), ImGuiCond_FirstUseEver);
@@ -136,14 +568,28 @@ namespace ipip {
         event.tile_window = ImGui::Button("do##SettingTile");
         ImGui::Text("Lock X:  "); ImGui::SameLine();
         ImGui::Checkbox("##LockX", &option.lock_x);
+        ImGui::Text("Scroll:  "); ImGui::SameLine();
+        ImGui::Checkbox("##Scroll", &option.scroll);
+        ImGui::Text("GPU Heat:"); ImGui::SameLine();
+        ImGui::Checkbox("##GpuHeatmap", &option.gpu_heatmap);
+        ImGui::Text("Budget:  "); ImGui::SameLine();
+        ImGui::SliderFloat("##IngestBudget", &option.ingest_budget, 1, 50, "%.0f ms");
+        ImGui::Text("Overflow:"); ImGui::SameLine();
+        ImGui::Combo("##Overflow", &option.overflow, "Reject\0Drop oldest\0Coalesce\0");
+        setOverflowPolicy((OverflowPolicy)option.overflow);
+        ImGui::Text("Max FPS: "); ImGui::SameLine();
+        ImGui::SliderFloat("##MaxFps", &option.max_fps, 5, 240, "%.0f");
+        ImGui::Text("Idle:    "); ImGui::SameLine();
+        ImGui::SliderFloat("##IdleRate", &option.idle_rate, 0.2f, 10, "%.1f Hz");
+        ImGui::Text("Compress:"); ImGui::SameLine();
+        ImGui::Checkbox("##Compress", &option.compress);
+        ImGui::Text("Keep:    "); ImGui::SameLine();
+        ImGui::SliderFloat("##Keep", &option.keep, 10, 3600, "%.0f s");
         ImGui::Text("Clear:   "); ImGui::SameLine();
-        if(ImGui::Button("do##SettingClear")) figure.clear();
+        if(ImGui::Button("do##SettingClear")) clearFigure();
         ImGui::End();
         if(memcmp(&option, &lastoption, sizeof(Options)) != 0) {
-            if(FILE * f = fopen("ipip.dat", "w")) {
-                fwrite(&option, sizeof(option), 1, f);
-                fclose(f);
-            }
+            saveOptions();
             lastoption = option;
         }
     }
@@ -151,12 +597,12 @@ namespace ipip {
     void showPerf(bool hasData) {
         static Stream perfStream("RenderTime");
         static Stream dataRecv("DataLatency");
-        static float lastTime = -1;
-        static float lastData = -1;
+        static double lastTime = -1;
+        static double lastData = -1;
         if(lastTime == -1) {
             lastTime = glfwGetTime();
         }
-        float curTime = glfwGetTime();
+        double curTime = glfwGetTime();
         perfStream.feed(curTime, curTime - lastTime);
         if(hasData) {
             if(lastData == -1) {
@@ -168,10 +614,29 @@ namespace ipip {
         lastTime = curTime;
         ImGui::SetNextWindowSize(ImVec2(400, 200), ImGuiCond_FirstUseEver);
         if(option.show_perf && ImGui::Begin("Performance")){
-            ImPlot::SetNextPlotLimitsX(0, option.history, ImGuiCond_Always);
+            TimeView view{curTime, option.history};
+            ImPlot::SetNextPlotLimitsX(view.minX(), view.maxX(), ImGuiCond_Always);
+            QueueStats stats = queueStats();
+            UdpStats udp = udpStats();
+            ImGui::Text("Queue: %zu / %zu  Full: %llu  Evicted: %llu  Coalesced: %llu  Backlog: %zu", stats.depth, stats.capacity,
+                (unsigned long long)stats.overflow, (unsigned long long)stats.evicted, (unsigned long long)stats.coalesced, ingestBacklog());
+            ImGui::Text("UDP: %llu received, %llu malformed, %llu dropped", (unsigned long long)udp.received, (unsigned long long)udp.malformed, (unsigned long long)udp.dropped);
+            RecorderStats rec = recorderStats();
+            if(rec.active) {
+                ImGui::Text("Recording: %llu samples, %llu blocks, %llu dropped", (unsigned long long)rec.samples, (unsigned long long)rec.blocks, (unsigned long long)rec.dropped);
+            }
+            RelayStats relay = relayStats();
+            if(relay.active) {
+                ImGui::Text("Relay: %s, %llu forwarded, %llu dropped, %llu reconnects", relay.connected ? "connected" : "offline",
+                    (unsigned long long)relay.samples, (unsigned long long)relay.dropped, (unsigned long long)relay.reconnects);
+            }
+            DeriveStats derive = deriveStats();
+            if(derive.streams) {
+                ImGui::Text("Spectrograms: %zu, %llu rows, %llu dropped", derive.streams, (unsigned long long)derive.rows, (unsigned long long)derive.dropped);
+            }
             if(ImPlot::BeginPlot("PerformancePlot", NULL, NULL, ImVec2(-1,-1))) {
-                perfStream.plotLine();
-                dataRecv.plotLine();
+                perfStream.plotLine(view);
+                dataRecv.plotLine(view);
                 ImPlot::EndPlot();
             }
             ImGui::End();
@@ -184,6 +649,7 @@ namespace ipip {
         int tailn = std::max(1, int(width / size.x));
         int idx = 0;
         for(auto & subp: figure) {
+            TimeView view{subp.latest, option.history};
             if(ImGui::Begin(subp.name.c_str())) {
                 if(event.tile_window) {
                     ImGui::SetWindowSize(size, ImGuiCond_Always);
@@ -193,14 +659,7 @@ namespace ipip {
                     ImGui::SetWindowSize(size, ImGuiCond_FirstUseEver);
                     ImGui::SetWindowPos(ImVec2(idx % tailn * size.x, idx / tailn * size.y), ImGuiCond_FirstUseEver);
                 }
-                if(ImGui::Button(("FitY##" + subp.name).c_str())) {
-                    ImPlot::SetNextPlotLimitsX(0, option.history, ImGuiCond_Always);
-                    ImPlot::FitNextPlotAxes(false, true);
-                }
-                else {
-                    ImPlot::SetNextPlotLimitsX(0, option.history, option.lock_x ? ImGuiCond_Always : ImGuiCond_None);
-                    ImPlot::SetNextPlotLimitsY(-5, 5);
-                }
+                bool fitY = ImGui::Button(("FitY##" + subp.name).c_str());
                 bool need_vlim = false;
                 for(auto & stream: subp.streams) {
                     if(stream.width > 1) need_vlim = true;
@@ -211,34 +670,87 @@ namespace ipip {
                     ImGui::InputFloat2(name.c_str(), subp.scale);
                     ImGui::SameLine();
                     if(ImGui::Button(("FitV##" + subp.name).c_str())) {
+                        // The windowed extremes the heatmaps' automatic range follows.
+                        double lo = INFINITY, hi = -INFINITY;
                         for(auto & stream: subp.streams) {
-                            if(stream.width > 1) {
-                                subp.scale[0] = std::min((double)subp.scale[0], stream.vmn);
-                                subp.scale[1] = std::max((double)subp.scale[0], stream.vmx);
+                            if(stream.width > 1 && !stream.stats.empty()) {
+                                lo = std::min(lo, stream.stats.min());
+                                hi = std::max(hi, stream.stats.max());
                             }
                         }
+                        if(lo <= hi) {
+                            subp.scale[0] = lo;
+                            subp.scale[1] = hi;
+                        }
                     }
                 }
-                std::string plotName = "##" + subp.name + "##PLOT";
-                if(event.colormap_changed) {
-                    ImPlot::BustColorCache(plotName.c_str());
+                if(event.colormap_changed) subp.bust_colors = true;
+                // Unchanged plots replay their last draw data and hidden ones
+                // are skipped; while the mouse works on a plot it is always live.
+                bool live = ImGui::IsWindowHovered(ImGuiHoveredFlags_ChildWindows | ImGuiHoveredFlags_AllowWhenBlockedByActiveItem)
+                    || (ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows) && ImGui::IsAnyMouseDown())
+                    || ImGui::IsPopupOpen("", ImGuiPopupFlags_AnyPopupId);
+                ImVec2 pos = ImGui::GetWindowPos(), wsize = ImGui::GetWindowSize();
+                // Each subplot follows its own newest sample, so data for other
+                // figures leaves it cached. Line plots in an unlocked scrolling
+                // view only follow their own limits.
+                bool follows = !(option.scroll && !option.lock_x && !need_vlim);
+                PlotKey key{subp.version, follows ? view.now : 0, {follows ? view.minX() : 0, follows ? view.maxX() : 0},
+                    option.history, option.colormap, {subp.scale[0], subp.scale[1]}, {pos.x, pos.y}, {wsize.x, wsize.y},
+                    option.scroll, option.lock_x};
+                ImDrawList * drawList = ImGui::GetWindowDrawList();
+                if(currentWindowHidden()) {
+                    // Nothing to draw.
+                }
+                else if(!live && subp.cache.valid && subp.key == key) {
+                    subp.cache.replay(drawList);
+                    ImGui::Dummy(ImGui::GetContentRegionAvail());
                 }
-                if(ImPlot::BeginPlot(plotName.c_str(), NULL, NULL, ImVec2(-1,-1))) {
-                    if(subp.stream_changed) {
-                        ImPlot::SetLegendLocation(ImPlotLocation_East, ImPlotOrientation_Vertical, true);
-                        subp.stream_changed = false;
+                else {
+                    if(fitY) {
+                        ImPlot::SetNextPlotLimitsX(view.minX(), view.maxX(), ImGuiCond_Always);
+                        ImPlot::FitNextPlotAxes(false, true);
+                    }
+                    else {
+                        ImPlot::SetNextPlotLimitsX(view.minX(), view.maxX(), option.lock_x ? ImGuiCond_Always : ImGuiCond_None);
+                        ImPlot::SetNextPlotLimitsY(-5, 5);
+                    }
+                    std::string plotName = "##" + subp.name + "##PLOT";
+                    if(subp.bust_colors) {
+                        ImPlot::BustColorCache(plotName.c_str());
+                        subp.bust_colors = false;
                     }
-                    for(auto & stream: subp.streams) {
-                        if(stream.width > 1) {
-                            ImPlot::PushColormap(option.colormap);
-                            stream.plotHeat(subp.scale[0], subp.scale[1]);
-                            ImPlot::PopColormap();
+                    DrawCache::Mark mark = DrawCache::mark(drawList);
+                    if(ImPlot::BeginPlot(plotName.c_str(), NULL, NULL, ImVec2(-1,-1))) {
+                        if(subp.stream_changed) {
+                            ImPlot::SetLegendLocation(ImPlotLocation_East, ImPlotOrientation_Vertical, true);
+                            subp.stream_changed = false;
+                        }
+                        for(auto & stream: subp.streams) {
+                            if(stream.width > 1) {
+                                ImPlot::PushColormap(option.colormap);
+                                stream.plotHeat(view, subp.scale[0], subp.scale[1]);
+                                ImPlot::PopColormap();
+                            }
+                            else {
+                                stream.plotLine(view);
+                            }
                         }
-                        else {
-                            stream.plotLine();
+                        for(auto & stream: subp.streams) {
+                            if(ImPlot::IsLegendEntryHovered(stream.name.c_str())) stream.showStats();
+                            if(stream.width == 1 && ImPlot::BeginLegendPopup(stream.name.c_str())) {
+                                stream.showArchive();
+                                ImPlot::EndLegendPopup();
+                            }
                         }
+                        ImPlot::EndPlot();
+                    }
+                    // A plot drawn while hovered carries hover highlights, so don't keep it.
+                    subp.cache.valid = false;
+                    if(!live) {
+                        subp.cache.capture(drawList, mark);
+                        subp.key = key;
                     }
-                    ImPlot::EndPlot();
                 }
                 if(idx == 0) newsize = ImGui::GetWindowSize();
             }
@@ -248,51 +760,229 @@ namespace ipip {
         size = newsize;
     }
 
-    Subplot & findSubplot(std::string name) {
-        for(auto & subp: figure)
-            if(subp.name == name)
-                return subp;
-        figure.emplace_back(name);
-        return figure.back();
+    Subplot & findSubplot(uint32_t subplot) {
+        if(subplot >= subplotSlot.size()) subplotSlot.resize(subplot + 1, nullptr);
+        if(!subplotSlot[subplot]) {
+            figure.emplace_back(subplot, subplotName(subplot));
+            subplotSlot[subplot] = &figure.back();
+        }
+        return *subplotSlot[subplot];
+    }
+
+    static void (*feedObserver)(double time) = nullptr;
+
+    void setFeedObserver(void (*observer)(double time)) {
+        feedObserver = observer;
+    }
+
+    void feedData(const SampleBatch & batch, size_t begin, size_t end) {
+        const double * values = batch.values.data();
+        for(size_t i = begin; i < end; i++) {
+            auto & rec = batch.records[i];
+            auto & subp = findSubplot(rec.subplot);
+            if(rec.stream == NoStream) continue;
+            if(std::isnan(timeOrigin)) timeOrigin = rec.time;
+            double tm = rec.time - timeOrigin;
+            subp.latest = std::max(subp.latest, tm);
+            subp.findStream(rec.stream).feed(tm, values + rec.offset, rec.count);
+            subp.version++;
+            if(feedObserver) feedObserver(rec.time);
+        }
+        deriveBatch(batch, begin, end);
+    }
+
+    // Summary of the stored streams for GET /status, refreshed from the
+    // thread that owns `figure`.
+    void publishState() {
+        Json::Value root;
+        QueueStats queue = queueStats();
+        UdpStats udp = udpStats();
+        root["queue"]["depth"] = (Json::UInt64)queue.depth;
+        root["queue"]["capacity"] = (Json::UInt64)queue.capacity;
+        root["queue"]["bytes"] = (Json::UInt64)queue.bytes;
+        root["queue"]["overflow"] = (Json::UInt64)queue.overflow;
+        root["queue"]["evicted"] = (Json::UInt64)queue.evicted;
+        root["queue"]["coalesced"] = (Json::UInt64)queue.coalesced;
+        root["queue"]["backlog"] = (Json::UInt64)ingestBacklog();
+        root["udp"]["received"] = (Json::UInt64)udp.received;
+        root["udp"]["malformed"] = (Json::UInt64)udp.malformed;
+        root["udp"]["dropped"] = (Json::UInt64)udp.dropped;
+        RecorderStats rec = recorderStats();
+        if(rec.active) {
+            root["record"]["samples"] = (Json::UInt64)rec.samples;
+            root["record"]["blocks"] = (Json::UInt64)rec.blocks;
+            root["record"]["dropped"] = (Json::UInt64)rec.dropped;
+        }
+        RelayStats relay = relayStats();
+        if(relay.active) {
+            root["relay"]["connected"] = relay.connected;
+            root["relay"]["samples"] = (Json::UInt64)relay.samples;
+            root["relay"]["dropped"] = (Json::UInt64)relay.dropped;
+            root["relay"]["reconnects"] = (Json::UInt64)relay.reconnects;
+        }
+        DeriveStats derive = deriveStats();
+        if(derive.streams) {
+            root["derive"]["streams"] = (Json::UInt64)derive.streams;
+            root["derive"]["rows"] = (Json::UInt64)derive.rows;
+            root["derive"]["dropped"] = (Json::UInt64)derive.dropped;
+        }
+        root["figures"] = Json::objectValue;
+        std::vector<StreamMetrics> streams;
+        std::vector<StreamInfo> catalog;
+        for(auto & subp: figure) {
+            Json::Value & fig = root["figures"][subp.name];
+            fig = Json::objectValue;
+            for(uint32_t id = 0; id < subp.streamSlot.size(); id++) {
+                if(!subp.streamSlot[id]) continue;
+                Stream & stream = *subp.streamSlot[id];
+                double latest = stream.store.empty() ? NAN : stream.store.back() + timeOrigin;
+                catalog.push_back(StreamInfo{subp.id, id, subp.name, stream.name, stream.width, stream.store.pushed, stream.stored(), latest});
+                streams.push_back(StreamMetrics{subp.name, stream.name, stream.store.pushed, stream.stored(), stream.memoryBytes()});
+                Json::Value & st = fig[stream.name];
+                st["width"] = stream.width;
+                st["samples"] = (Json::UInt64)stream.store.pushed;
+                st["stored"] = (Json::UInt64)stream.stored();
+                if(!stream.store.empty()) st["latest"] = latest;
+                st["min"] = stream.vmn;
+                st["max"] = stream.vmx;
+                if(stream.archive) {
+                    st["compressed"]["samples"] = (Json::UInt64)stream.archive->rows();
+                    st["compressed"]["bytes"] = (Json::UInt64)stream.archive->bytes();
+                }
+                if(!stream.stats.empty()) {
+                    Json::Value & win = st["window"];
+                    win["min"] = stream.stats.min();
+                    win["max"] = stream.stats.max();
+                    if(stream.width == 1) {
+                        win["samples"] = (Json::UInt64)stream.stats.count();
+                        win["mean"] = stream.stats.mean();
+                        win["std"] = stream.stats.stddev();
+                        win["rms"] = stream.stats.rms();
+                        win["p50"] = stream.stats.quantile(0.5);
+                        win["p99"] = stream.stats.quantile(0.99);
+                    }
+                }
+            }
+        }
+        Json::StreamWriterBuilder builder;
+        builder["indentation"] = "";
+        publishStatus(Json::writeString(builder, root));
+        publishStreamMetrics(std::move(streams));
+        publishCatalog(std::move(catalog));
     }
 
-    void feedData(Json::Value data) {
-        ipipAssert(data.isMember("time") && data["time"].isNumeric(), "time not found", data);
-        double tm = data["time"].asDouble();
-        for(std::string figName: data.getMemberNames()) {
-            if(figName == "time") continue;
-            auto & subp = findSubplot(figName);
-            if(data[figName].isNull()) continue;
-            if(data[figName].isObject()) {
-                for(std::string streamName: data[figName].getMemberNames()) {
-                    auto & subplotData = data[figName][streamName];
-                    if(subplotData.isNull()) continue;
-                    subp.findStream(streamName).feed(tm, subplotData);
+    // Keeps mirrors on the streams GET /data reads, drops idle ones and
+    // republishes the snapshots of streams that changed.
+    static void publishSnapshots() {
+        std::vector<uint64_t> wanted = wantedStreams();
+        for(auto & subp: figure) {
+            for(uint32_t id = 0; id < subp.streamSlot.size(); id++) {
+                Stream * stream = subp.streamSlot[id];
+                if(!stream) continue;
+                uint64_t key = streamKey(subp.id, id);
+                if(!std::binary_search(wanted.begin(), wanted.end(), key)) {
+                    if(stream->mirror) {
+                        stream->mirror.reset();
+                        dropSnapshot(key);
+                    }
+                    continue;
                 }
+                if(!stream->mirror) stream->attachMirror();
+                uint64_t version = stream->store.pushed + stream->store.resets;
+                if(stream->mirror->published == version) continue;
+                double front = stream->store.empty() ? 0 : stream->historyFront();
+                publishSnapshot(key, stream->mirror->snapshot(stream->width, timeOrigin, front));
+                stream->mirror->published = version;
             }
-            else {
-                subp.findStream("data").feed(tm, data[figName]);
+        }
+    }
+
+    // Feeds queued samples until the queue is empty or `budget` seconds have
+    // passed. Whatever is left, down to part of a batch, carries over to the
+    // next call and stays in the server queue, where the overflow policy
+    // pushes back on producers.
+    bool ingest(double budget) {
+        static auto lastPublish = std::chrono::steady_clock::time_point{};
+        static auto lastSnapshot = std::chrono::steady_clock::time_point{};
+        const size_t PopChunk = 64, FeedChunk = 4096;
+        auto start = std::chrono::steady_clock::now();
+        auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(std::min(budget, 3600.0)));
+        bool hasData = false;
+        for(;;) {
+            if(ingestNext == ingestBatches.size()) {
+                ingestBatches.clear();
+                ingestNext = 0;
+                if(popQueue(ingestBatches, PopChunk) == 0) break;
+            }
+            hasData = true;
+            SampleBatch & batch = ingestBatches[ingestNext];
+            size_t end = std::min(batch.records.size(), ingestRecord + FeedChunk);
+            feedData(batch, ingestRecord, end);
+            metrics.samplesFed.add(end - ingestRecord);
+            ingestRecord = end;
+            if(ingestRecord == batch.records.size()) {
+                relayBatch(batch);
+                recordBatch(std::move(batch));
+                ingestNext++;
+                ingestRecord = 0;
             }
+            if(std::chrono::steady_clock::now() >= deadline) break;
         }
+        auto now = std::chrono::steady_clock::now();
+        if(hasData) metrics.feed.observe(std::chrono::duration<double>(now - start).count());
+        if(now - lastPublish > std::chrono::milliseconds(500)) {
+            publishState();
+            lastPublish = now;
+        }
+        if(now - lastSnapshot > std::chrono::milliseconds(20)) {
+            publishSnapshots();
+            lastSnapshot = now;
+        }
+        return hasData;
     }
 
     void updateWindow(GLFWwindow * window) {
+        ScopedTimer timer{metrics.frame};
         int width, height;
         glfwGetWindowSize(window, &width, &height);
         showSettings();
-        Json::Value data;
-        bool hasData = false;
-        while(popQueue(data)) {
-            hasData = true;
-            try {
-                feedData(data);
-            }
-            catch(std::runtime_error e) {
-                std::cout << "Invalid format: " << e.what() << std::endl << data << std::endl;
-            }
-        }
+        bool hasData = ingest(option.ingest_budget * 1e-3);
         showFigure(width, height);
         showPerf(hasData);
     }
 
+    double frameInterval() {
+        return 1.0 / std::max(1.0f, option.max_fps);
+    }
+
+    double idleInterval() {
+        return 1.0 / std::max(0.01f, option.idle_rate);
+    }
+
+    // Samples are waiting to be fed, or a widget animates (text cursor).
+    bool needsFrame() {
+        return queueStats().depth > 0 || ingestBacklog() > 0 || ImGui::GetIO().WantTextInput;
+    }
+
+    static std::thread headlessThread;
+    static std::atomic<bool> headlessRunning{false};
+
+    void initHeadless() {
+        loadOptions();
+        setOverflowPolicy((OverflowPolicy)option.overflow);
+        headlessRunning = true;
+        headlessThread = std::thread([] {
+            while(headlessRunning) {
+                if(!ingest(0.1)) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+        });
+    }
+
+    void stopHeadless() {
+        headlessRunning = false;
+        if(headlessThread.joinable()) headlessThread.join();
+    }
+
 } // namespace ipip
@@ -1,9 +1,26 @@
 #pragma once
 
 #include<GLFW/glfw3.h>
+#include <json/json.h>
 
 namespace ipip {
     void updateWindow(GLFWwindow * window);
     void initServer(int port);
     void stopServer();
+    void setWakeCallback(void (*wake)());
+    void initHeadless();
+    void stopHeadless();
+    // Built-in default settings; ipip.dat is then neither read nor written.
+    void useDefaultOptions();
+    // The settings in effect, for reports.
+    Json::Value optionsJson();
+    // Frees GL resources; call while the context is still current.
+    void releaseGraphics();
+    // Called on the ingest thread with the raw time of every stored sample.
+    void setFeedObserver(void (*observer)(double time));
+    // Frame pacing for the render loop: the minimum frame interval (FPS cap),
+    // how long to sleep while idle, and whether a frame is due regardless.
+    double frameInterval();
+    double idleInterval();
+    bool needsFrame();
 } // namespace ipip
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "storage.h"
+
+namespace ipip {
+
+    // Min/max (M4) level of detail for line plots. Samples are binned into
+    // buckets one pixel column wide, aligned to a fixed time grid so that a
+    // scrolling view keeps its buckets; each bucket remembers its first, min,
+    // max and last sample. New samples are folded in incrementally and only a
+    // change of bucket width or a jump back in time forces a rebuild.
+    struct M4Cache {
+        struct Bucket {
+            int64_t key;
+            double t[4];
+            double v[4];
+        };
+
+        double width{0};
+        double lo{0};
+        uint64_t pushed{0};
+        uint64_t resets{0};
+        std::deque<Bucket> buckets;
+
+        // Brings the buckets up to date for samples from time `lo` onwards.
+        // Returns false when nothing changed since the last call.
+        bool update(const RingStore & store, double lo, double width) {
+            bool rebuild = buckets.empty() || std::abs(width - this->width) > 1e-6 * width || lo < this->lo
+                || store.resets != resets || store.pushed - pushed > store.size();
+            if(!rebuild && store.pushed == pushed && lo == this->lo) return false;
+            size_t begin;
+            if(rebuild) {
+                buckets.clear();
+                this->width = width;
+                resets = store.resets;
+                begin = store.lowerBound(std::floor(lo / width) * width);
+            }
+            else {
+                begin = store.size() - (store.pushed - pushed);
+            }
+            for(size_t i = begin; i < store.size(); i++) {
+                add(store.timeAt(i), store.valueAt(i)[0]);
+            }
+            pushed = store.pushed;
+            this->lo = lo;
+            while(!buckets.empty() && (buckets.front().key + 1) * this->width < lo) {
+                buckets.pop_front();
+            }
+            return true;
+        }
+
+        // Appends the points of the buckets starting in [lo, hi), moved by `shift`.
+        void emit(double lo, double hi, double shift, std::vector<double> & xs, std::vector<double> & ys) const {
+            for(auto & b: buckets) {
+                double start = b.key * width;
+                if(start < lo - width) continue;
+                if(start >= hi) break;
+                int order[4] = {0, 1, 2, 3};
+                if(b.t[2] < b.t[1]) std::swap(order[1], order[2]);
+                for(int k = 0; k < 4; k++) {
+                    int i = order[k];
+                    if(k > 0 && b.t[i] == b.t[order[k - 1]]) continue;
+                    xs.push_back(b.t[i] + shift);
+                    ys.push_back(b.v[i]);
+                }
+            }
+        }
+
+        // Folds in one sample no older than the last one.
+        void add(double t, double v) {
+            int64_t key = (int64_t)std::floor(t / width);
+            if(buckets.empty() || key > buckets.back().key) {
+                buckets.push_back(Bucket{key, {t, t, t, t}, {v, v, v, v}});
+                return;
+            }
+            auto & b = buckets.back();
+            if(v < b.v[1]) { b.t[1] = t; b.v[1] = v; }
+            if(v > b.v[2]) { b.t[2] = t; b.v[2] = v; }
+            b.t[3] = t;
+            b.v[3] = v;
+        }
+    };
+
+} // namespace ipip
@@ -12,28 +12,153 @@
 #include <cstdlib>
 #include <json/config.h>
 #include <iostream>
+#include <cstring>
+#include <csignal>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
 
 GLFWwindow * window;
 
 #include "ipip.h"
+#include "record.h"
+#include "derive.h"
+#include "relay.h"
 
 static void glfw_error_callback(int error, const char* description)
 {
     fprintf(stderr, "Glfw Error %d: %s\n", error, description);
 }
 
+static std::atomic<bool> quit{false};
+
+static void usage(const char * program)
+{
+    fprintf(stderr,
+        "usage: %s [port] [--headless] [--record FILE] [--replay FILE] [--speed X|max]\n"
+        "          [--derive JSON]... [--relay URL] [--relay-name NAME] [--relay-rate N]\n", program);
+}
+
+static bool isPort(const char * arg)
+{
+    if(!*arg || strlen(arg) > 5)
+        return false;
+    for(const char * p = arg; *p; p++) {
+        if(*p < '0' || *p > '9')
+            return false;
+    }
+    int port = std::atoi(arg);
+    return port > 0 && port < 65536;
+}
+
+static void signal_callback(int)
+{
+    quit = true;
+}
+
+// Stops what was started before the server, when startup fails.
+static void abortStartup()
+{
+    ipip::stopDerive();
+    ipip::stopRelay();
+    ipip::stopRecorder();
+}
+
 int main(int argc, char** argv)
 {
-    if(argc > 2) {
-        ipip::initServer(std::atoi(argv[1]));
+    int port = 1132;
+    bool headless = false;
+    const char * recordPath = nullptr;
+    const char * replayPath = nullptr;
+    double speed = 1;
+    std::vector<const char *> derives;
+    const char * relayUrl = nullptr;
+    std::string relayName;
+    double relayRate = 0;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        }
+        else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--derive") == 0 && i + 1 < argc) {
+            derives.push_back(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--relay") == 0 && i + 1 < argc) {
+            relayUrl = argv[++i];
+        }
+        else if(strcmp(argv[i], "--relay-name") == 0 && i + 1 < argc) {
+            relayName = argv[++i];
+        }
+        else if(strcmp(argv[i], "--relay-rate") == 0 && i + 1 < argc) {
+            relayRate = std::atof(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            i++;
+            speed = strcmp(argv[i], "max") == 0 ? 0 : std::atof(argv[i]);
+        }
+        else if(isPort(argv[i])) {
+            port = std::atoi(argv[i]);
+        }
+        else {
+            // Unknown flags, flags missing their value and stray words.
+            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    ipip::initDerive();
+    for(const char * spec: derives) {
+        try {
+            ipip::addSpectrogram(ipip::parseSpectrogram(spec, spec + strlen(spec)));
+        }
+        catch(std::runtime_error & e) {
+            std::cout << "Invalid --derive: " << e.what() << std::endl;
+            ipip::stopDerive();
+            return 1;
+        }
     }
-    else {
-        ipip::initServer(1132);
+    // Whatever can fail is set up before the server and the replay start
+    // producing samples, so an early return has only these to stop.
+    if(recordPath && !ipip::initRecorder(recordPath)) {
+        abortStartup();
+        return 1;
+    }
+    if(relayUrl && !ipip::initRelay(relayUrl, relayName.empty() ? std::to_string(port) : relayName, relayRate)) {
+        abortStartup();
+        return 1;
+    }
+    if(headless) {
+        ipip::initServer(port);
+        if(replayPath)
+            ipip::initReplay(replayPath, speed);
+        // No window: ingest and storage run on their own thread until SIGINT/SIGTERM.
+        std::signal(SIGINT, signal_callback);
+        std::signal(SIGTERM, signal_callback);
+        ipip::initHeadless();
+        while(!quit) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        ipip::stopReplay();
+        ipip::stopServer();
+        ipip::stopHeadless();
+        ipip::stopDerive();
+        ipip::stopRelay();
+        ipip::stopRecorder();
+        return 0;
     }
     // Setup window
     glfwSetErrorCallback(glfw_error_callback);
-    if (!glfwInit())
+    if (!glfwInit()) {
+        abortStartup();
         return 1;
+    }
 
     // GL 3.0 + GLSL 130
     const char* glsl_version = "#version 130";
@@ -47,11 +172,18 @@ int main(int argc, char** argv)
     glfwGetMonitorWorkarea(monitor, &x, &y, &w, &h);
     // Create window with graphics context
     window = glfwCreateWindow(w, h, "IPIP Window", NULL, NULL);
-    if (window == NULL)
+    if (window == NULL) {
+        glfwTerminate();
+        abortStartup();
         return 1;
+    }
     glfwMakeContextCurrent(window);
     glfwSwapInterval(1); // Enable vsync
 
+    ipip::initServer(port);
+    if(replayPath)
+        ipip::initReplay(replayPath, speed);
+
     // Setup Dear ImGui context
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -92,6 +224,12 @@ int main(int argc, char** argv)
     ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
     
     // Main loop
+    // Event driven: sleep until input, new samples (the server posts an empty
+    // event) or the idle interval, and only draw when something may have
+    // changed or the idle interval passed. ImGui needs a couple of frames to settle after an event.
+    ipip::setWakeCallback(glfwPostEmptyEvent);
+    int settleFrames = 3;
+    double lastFrame = -1;
     while (!glfwWindowShouldClose(window))
     {
         // Poll and handle events (inputs, window resize, etc.)
@@ -99,7 +237,31 @@ int main(int argc, char** argv)
         // - When io.WantCaptureMouse is true, do not dispatch mouse input data to your main application.
         // - When io.WantCaptureKeyboard is true, do not dispatch keyboard input data to your main application.
         // Generally you may always pass all inputs to dear imgui, and hide them from your application based on those two flags.
-        glfwPollEvents();
+        double wait = settleFrames > 0 || ipip::needsFrame() ? 0 : ipip::idleInterval();
+        // A wait that ran its full length draws one frame at the idle rate.
+        bool idleFrame = false;
+        if (wait > 0) {
+            double before = glfwGetTime();
+            glfwWaitEventsTimeout(wait);
+            if (glfwGetTime() - before < wait)
+                settleFrames = 3;
+            else
+                idleFrame = true;
+        }
+        else {
+            glfwPollEvents();
+        }
+        if (settleFrames == 0 && !idleFrame && !ipip::needsFrame())
+            continue;
+        double interval = ipip::frameInterval();
+        double now = glfwGetTime();
+        if (lastFrame >= 0 && now - lastFrame < interval) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(interval - (now - lastFrame)));
+            glfwPollEvents();
+        }
+        lastFrame = glfwGetTime();
+        if (settleFrames > 0)
+            settleFrames--;
 
         // Start the Dear ImGui frame
         ImGui_ImplOpenGL3_NewFrame();
@@ -124,7 +286,16 @@ int main(int argc, char** argv)
         glfwSwapBuffers(window);
     }
 
-    // Cleanup
+    // Cleanup. Producers stop first and the wake callback is cleared, so no
+    // thread posts to GLFW once it is terminated.
+    ipip::stopReplay();
+    ipip::stopServer();
+    ipip::stopDerive();
+    ipip::setWakeCallback(nullptr);
+    ipip::stopRelay();
+    ipip::stopRecorder();
+
+    ipip::releaseGraphics();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImPlot::DestroyContext();
@@ -132,7 +303,5 @@ int main(int argc, char** argv)
 
     glfwDestroyWindow(window);
     glfwTerminate();
-
-    ipip::stopServer();
     return 0;
 }
@@ -0,0 +1,120 @@
+#include "metrics.h"
+#include <algorithm>
+#include <mutex>
+#include <sstream>
+
+namespace ipip {
+
+    Metrics metrics;
+
+    const double Histogram::Bounds[Histogram::Buckets] = {
+        0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025,
+        0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 1, 5,
+    };
+
+    void Histogram::observe(double seconds) {
+        int bucket = std::lower_bound(Bounds, Bounds + Buckets, seconds) - Bounds;
+        counts[bucket].fetch_add(1, std::memory_order_relaxed);
+        nanos.fetch_add(uint64_t(seconds * 1e9), std::memory_order_relaxed);
+    }
+
+    static std::mutex streamLock;
+    static std::vector<StreamMetrics> streamMetrics;
+
+    void publishStreamMetrics(std::vector<StreamMetrics> streams) {
+        std::lock_guard<std::mutex> guard(streamLock);
+        streamMetrics.swap(streams);
+    }
+
+    static const char * sourceNames[SourceCount] = {"json", "stream", "binary", "udp"};
+
+    static std::string label(const std::string & value) {
+        std::string out;
+        for(char c: value) {
+            if(c == '\\' || c == '"') out += '\\';
+            if(c == '\n') {
+                out += "\\n";
+                continue;
+            }
+            out += c;
+        }
+        return out;
+    }
+
+    static void header(std::ostream & os, const char * name, const char * type, const char * help) {
+        os << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n';
+    }
+
+    static void histogram(std::ostream & os, const char * name, const std::string & labels, const Histogram & hist) {
+        std::string sep = labels.empty() ? "" : labels + ",";
+        uint64_t total = 0;
+        for(int i = 0; i < Histogram::Buckets; i++) {
+            total += hist.counts[i].load(std::memory_order_relaxed);
+            os << name << "_bucket{" << sep << "le=\"" << Histogram::Bounds[i] << "\"} " << total << '\n';
+        }
+        total += hist.counts[Histogram::Buckets].load(std::memory_order_relaxed);
+        os << name << "_bucket{" << sep << "le=\"+Inf\"} " << total << '\n';
+        std::string braces = labels.empty() ? "" : "{" + labels + "}";
+        os << name << "_sum" << braces << ' ' << hist.nanos.load(std::memory_order_relaxed) * 1e-9 << '\n';
+        os << name << "_count" << braces << ' ' << total << '\n';
+    }
+
+    std::string renderMetrics(size_t queueDepth, size_t queueCapacity, uint64_t queueOverflow) {
+        std::ostringstream os;
+        header(os, "ipip_requests_total", "counter", "HTTP requests and UDP datagrams received.");
+        for(int s = 0; s < SourceCount; s++) {
+            os << "ipip_requests_total{source=\"" << sourceNames[s] << "\"} " << metrics.ingest[s].requests.get() << '\n';
+        }
+        header(os, "ipip_received_bytes_total", "counter", "Ingest payload bytes received.");
+        for(int s = 0; s < SourceCount; s++) {
+            os << "ipip_received_bytes_total{source=\"" << sourceNames[s] << "\"} " << metrics.ingest[s].bytes.get() << '\n';
+        }
+        header(os, "ipip_parse_failures_total", "counter", "Payloads or NDJSON lines rejected as malformed.");
+        for(int s = 0; s < SourceCount; s++) {
+            os << "ipip_parse_failures_total{source=\"" << sourceNames[s] << "\"} " << metrics.ingest[s].failures.get() << '\n';
+        }
+        header(os, "ipip_parse_seconds", "histogram", "Time spent parsing one payload.");
+        for(int s = 0; s < SourceCount; s++) {
+            histogram(os, "ipip_parse_seconds", std::string("source=\"") + sourceNames[s] + "\"", metrics.ingest[s].parse);
+        }
+
+        header(os, "ipip_queue_depth", "gauge", "Batches waiting for the render thread.");
+        os << "ipip_queue_depth " << queueDepth << '\n';
+        header(os, "ipip_queue_capacity", "gauge", "Capacity of the ingest queue.");
+        os << "ipip_queue_capacity " << queueCapacity << '\n';
+        header(os, "ipip_queue_high_water", "gauge", "Highest queue depth seen.");
+        os << "ipip_queue_high_water " << metrics.queueHighWater.get() << '\n';
+        header(os, "ipip_queue_overflow_total", "counter", "Pushes that found the queue full.");
+        os << "ipip_queue_overflow_total " << queueOverflow << '\n';
+        header(os, "ipip_queue_evicted_total", "counter", "Queued batches evicted by the drop-oldest policy.");
+        os << "ipip_queue_evicted_total " << metrics.queueEvicted.get() << '\n';
+        header(os, "ipip_queue_coalesced_total", "counter", "Batches folded into the coalesced batch.");
+        os << "ipip_queue_coalesced_total " << metrics.queueCoalesced.get() << '\n';
+
+        header(os, "ipip_fed_samples_total", "counter", "Samples stored by feedData.");
+        os << "ipip_fed_samples_total " << metrics.samplesFed.get() << '\n';
+        header(os, "ipip_feed_seconds", "histogram", "Time spent in feedData per drained queue.");
+        histogram(os, "ipip_feed_seconds", "", metrics.feed);
+        header(os, "ipip_frame_seconds", "histogram", "Time spent in updateWindow per frame.");
+        histogram(os, "ipip_frame_seconds", "", metrics.frame);
+
+        std::lock_guard<std::mutex> guard(streamLock);
+        uint64_t stored = 0, bytes = 0;
+        header(os, "ipip_stream_samples_total", "counter", "Samples received per stream.");
+        for(auto & st: streamMetrics) {
+            os << "ipip_stream_samples_total{figure=\"" << label(st.figure) << "\",stream=\"" << label(st.stream) << "\"} " << st.samples << '\n';
+            stored += st.stored;
+            bytes += st.bytes;
+        }
+        header(os, "ipip_stream_stored_points", "gauge", "Rows currently held per stream.");
+        for(auto & st: streamMetrics) {
+            os << "ipip_stream_stored_points{figure=\"" << label(st.figure) << "\",stream=\"" << label(st.stream) << "\"} " << st.stored << '\n';
+        }
+        header(os, "ipip_stored_points", "gauge", "Rows currently held by all streams.");
+        os << "ipip_stored_points " << stored << '\n';
+        header(os, "ipip_storage_bytes", "gauge", "Memory allocated for stream storage.");
+        os << "ipip_storage_bytes " << bytes << '\n';
+        return os.str();
+    }
+
+} // namespace ipip
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ipip {
+
+    // Lock-free instruments for GET /metrics (Prometheus text format).
+    // Hot paths only do relaxed atomic adds; everything is read when scraped.
+
+    struct Counter {
+        std::atomic<uint64_t> value{0};
+        void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+        uint64_t get() const { return value.load(std::memory_order_relaxed); }
+    };
+
+    struct MaxGauge {
+        std::atomic<uint64_t> value{0};
+        void update(uint64_t v) {
+            uint64_t cur = value.load(std::memory_order_relaxed);
+            while(v > cur && !value.compare_exchange_weak(cur, v, std::memory_order_relaxed));
+        }
+        uint64_t get() const { return value.load(std::memory_order_relaxed); }
+    };
+
+    // Durations in seconds over fixed buckets, 10 us to 5 s.
+    struct Histogram {
+        static const int Buckets = 16;
+        static const double Bounds[Buckets];
+        std::atomic<uint64_t> counts[Buckets + 1]{};
+        std::atomic<uint64_t> nanos{0};
+
+        void observe(double seconds);
+    };
+
+    // Measures the lifetime of the scope into a histogram.
+    struct ScopedTimer {
+        Histogram & hist;
+        std::chrono::steady_clock::time_point start{std::chrono::steady_clock::now()};
+        ~ScopedTimer() { hist.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()); }
+    };
+
+    enum IngestSource {
+        SourceJson,
+        SourceStream,
+        SourceBinary,
+        SourceUdp,
+        SourceCount,
+    };
+
+    struct IngestMetrics {
+        Counter requests;
+        Counter bytes;
+        Counter failures;
+        Histogram parse;
+    };
+
+    struct Metrics {
+        IngestMetrics ingest[SourceCount];
+        MaxGauge queueHighWater;
+        Counter queueEvicted;
+        Counter queueCoalesced;
+        Counter samplesFed;
+        Histogram feed;
+        Histogram frame;
+    };
+
+    extern Metrics metrics;
+
+    // Per-stream figures owned by the render thread, published periodically.
+    struct StreamMetrics {
+        std::string figure;
+        std::string stream;
+        uint64_t samples;
+        uint64_t stored;
+        uint64_t bytes;
+    };
+
+    void publishStreamMetrics(std::vector<StreamMetrics> streams);
+
+    // Prometheus exposition text; `queue` gauges are sampled by the caller.
+    std::string renderMetrics(size_t queueDepth, size_t queueCapacity, uint64_t queueOverflow);
+
+} // namespace ipip
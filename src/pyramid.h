@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ipip {
+
+    // Long term history of a line stream beyond what the RingStore keeps.
+    // Every sample is folded into a few tiers of fixed-width buckets holding
+    // min, max and mean; tier k has buckets BaseWidth * Factor^k seconds wide
+    // and keeps the ones of the last `keep` seconds, at most Rows of them,
+    // so memory is bounded while the coarsest tier spans up to 5.8 hours.
+    struct HistoryPyramid {
+        static const int Tiers = 4;
+        static const int Factor = 8;
+        static constexpr size_t Rows = 4096;
+        static constexpr double BaseWidth = 0.01;
+
+        struct Bucket {
+            int64_t key;
+            double min;
+            double max;
+            double sum;
+            uint32_t count;
+
+            double mean() const { return sum / count; }
+        };
+
+        struct Tier {
+            double width{0};
+            size_t rows{Rows};
+            std::vector<Bucket> buckets;
+            size_t head{0};
+
+            size_t size() const { return buckets.size(); }
+            bool full() const { return buckets.size() == rows; }
+            const Bucket & at(size_t row) const { return buckets[(head + row) % buckets.size()]; }
+            const Bucket & back() const { return at(size() - 1); }
+            double start(size_t row) const { return at(row).key * width; }
+
+            void add(double t, double v) {
+                int64_t key = (int64_t)std::floor(t / width);
+                if(buckets.empty() || key > back().key) {
+                    Bucket b{key, v, v, v, 1};
+                    if(full()) {
+                        buckets[head] = b;
+                        head = (head + 1) % rows;
+                    }
+                    else {
+                        buckets.push_back(b);
+                    }
+                    return;
+                }
+                // Late samples land in the newest bucket.
+                auto & b = buckets[(head + size() - 1) % size()];
+                b.min = std::min(b.min, v);
+                b.max = std::max(b.max, v);
+                b.sum += v;
+                b.count++;
+            }
+
+            // First row whose bucket ends after t.
+            size_t lowerBound(double t) const {
+                size_t lo = 0, hi = size();
+                while(lo < hi) {
+                    size_t mid = (lo + hi) / 2;
+                    if(start(mid) + width <= t) lo = mid + 1;
+                    else hi = mid;
+                }
+                return lo;
+            }
+        };
+
+        Tier tiers[Tiers];
+        double keep;
+
+        explicit HistoryPyramid(double keep): keep{keep} { clear(); }
+
+        bool empty() const { return tiers[0].size() == 0; }
+
+        void clear() {
+            double width = BaseWidth;
+            for(auto & tier: tiers) {
+                tier = Tier{};
+                tier.width = width;
+                tier.rows = std::min<size_t>(Rows, std::max(1.0, std::ceil(keep / width)));
+                width *= Factor;
+            }
+        }
+
+        void add(double t, double v) {
+            if(std::isnan(v)) return;
+            for(auto & tier: tiers) tier.add(t, v);
+        }
+
+        // Finest tier that still reaches back to `lo` and shows at most
+        // `limit` buckets over [lo, hi); the coarsest one otherwise.
+        const Tier & pick(double lo, double hi, double limit) const {
+            for(auto & tier: tiers) {
+                bool covers = !tier.full() || tier.start(0) <= lo;
+                if(covers && (hi - lo) / tier.width <= limit) return tier;
+            }
+            return tiers[Tiers - 1];
+        }
+
+        // Appends bucket centers, min, max and mean of the buckets of `tier` overlapping [lo, hi).
+        void emit(const Tier & tier, double lo, double hi, std::vector<double> & xs,
+                  std::vector<double> & mins, std::vector<double> & maxs, std::vector<double> & means) const {
+            for(size_t i = tier.lowerBound(lo); i < tier.size() && tier.start(i) < hi; i++) {
+                auto & b = tier.at(i);
+                xs.push_back(tier.start(i) + tier.width / 2);
+                mins.push_back(b.min);
+                maxs.push_back(b.max);
+                means.push_back(b.mean());
+            }
+        }
+    };
+
+} // namespace ipip
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace ipip {
+
+    // Bounded lock-free multi-producer / single-consumer ring.
+    // Each slot carries a sequence number (Vyukov style): producers race on
+    // `tail`, and slots are claimed from `head` by CAS so that a producer
+    // may also evict the oldest item while the consumer drains.
+    template<class T>
+    class MpscRing {
+        struct Slot {
+            std::atomic<size_t> seq{0};
+            T value{};
+        };
+
+        static size_t roundCapacity(size_t capacity) {
+            size_t cap = 2;
+            while(cap < capacity) cap <<= 1;
+            return cap;
+        }
+
+        const size_t cap;
+        const size_t mask;
+        std::unique_ptr<Slot[]> slots;
+        alignas(64) std::atomic<size_t> tail{0};
+        alignas(64) std::atomic<size_t> head{0};
+        alignas(64) std::atomic<uint64_t> overflowCount{0};
+
+    public:
+        explicit MpscRing(size_t capacity):
+            cap{roundCapacity(capacity)}, mask{cap - 1}, slots{new Slot[cap]} {
+            for(size_t i = 0; i < cap; i++) {
+                slots[i].seq.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        MpscRing(const MpscRing &) = delete;
+        MpscRing & operator=(const MpscRing &) = delete;
+
+        // Moves `value` into the ring. Returns false and bumps the overflow
+        // counter when the ring is full; `value` is left untouched then.
+        bool push(T && value) {
+            size_t pos = tail.load(std::memory_order_relaxed);
+            for(;;) {
+                Slot & slot = slots[pos & mask];
+                size_t seq = slot.seq.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+                if(diff == 0) {
+                    if(tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        slot.value = std::move(value);
+                        slot.seq.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if(diff < 0) {
+                    overflowCount.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                else {
+                    pos = tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Moves up to `max` ready items to the end of `out`. Items are claimed
+        // one by one so that producers evicting with dropOldest never race
+        // with the consumer over a slot.
+        size_t popBatch(std::vector<T> & out, size_t max = SIZE_MAX) {
+            size_t n = 0;
+            while(n < max) {
+                out.emplace_back();
+                if(!pop(out.back())) {
+                    out.pop_back();
+                    break;
+                }
+                n++;
+            }
+            return n;
+        }
+
+        bool pop(T & value) {
+            size_t pos = head.load(std::memory_order_relaxed);
+            for(;;) {
+                Slot & slot = slots[pos & mask];
+                size_t seq = slot.seq.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+                if(diff == 0) {
+                    if(head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        value = std::move(slot.value);
+                        slot.value = T{};
+                        slot.seq.store(pos + cap, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if(diff < 0) {
+                    return false;
+                }
+                else {
+                    pos = head.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Discards the oldest item to make room, for drop-oldest producers.
+        bool dropOldest() {
+            T value;
+            return pop(value);
+        }
+
+        size_t depth() const {
+            size_t t = tail.load(std::memory_order_relaxed);
+            size_t h = head.load(std::memory_order_relaxed);
+            return t > h ? t - h : 0;
+        }
+
+        size_t capacity() const { return cap; }
+        uint64_t overflows() const { return overflowCount.load(std::memory_order_relaxed); }
+    };
+
+} // namespace ipip
@@ -0,0 +1,435 @@
+#include "record.h"
+#include "queue.h"
+#include "server.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ipip {
+
+    enum ChunkKind : uint32_t {
+        ChunkStream = 1,
+        ChunkBlock = 2,
+        ChunkIndex = 3,
+    };
+
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+    };
+
+    struct ChunkHeader {
+        uint32_t kind;
+        uint32_t key;
+        uint64_t bytes;
+    };
+
+    struct StreamHeader {
+        uint32_t width;
+        uint16_t figLen;
+        uint16_t nameLen;
+    };
+
+    struct BlockHeader {
+        uint32_t rows;
+        uint32_t width;
+        double tmin;
+        double tmax;
+    };
+
+    // rows == 0 marks the chunk of a stream declaration.
+    struct IndexEntry {
+        uint32_t key;
+        uint32_t rows;
+        double tmin;
+        double tmax;
+        uint64_t offset;
+    };
+
+    struct Footer {
+        uint64_t index;
+        char magic[8];
+    };
+
+    static_assert(sizeof(FileHeader) == 16 && sizeof(ChunkHeader) == 16 && sizeof(BlockHeader) == 24
+        && sizeof(IndexEntry) == 32 && sizeof(Footer) == 16, "record structs must be packed");
+
+    const char RecordMagic[8] = "IPIPREC";
+    const char IndexMagic[8] = "IPIPIDX";
+    const uint32_t BlockRows = 4096;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Writer
+
+    struct Column {
+        uint32_t key;
+        uint32_t width;
+        std::vector<double> time;
+        std::vector<double> value;
+    };
+
+    struct Part {
+        const void * data;
+        size_t bytes;
+    };
+
+    static MpscRing<SampleBatch> recordQueue(1 << 14);
+    static std::thread recordThread;
+    static std::atomic<bool> recording{false};
+    static std::atomic<uint64_t> recordSamples{0}, recordBlocks{0};
+    static FILE * recordFile = nullptr;
+    static uint64_t recordOffset = 0;
+    static std::vector<IndexEntry> recordIndex;
+
+    static uint64_t writeChunk(uint32_t kind, uint32_t key, std::initializer_list<Part> parts) {
+        static const char zeros[8] = {};
+        uint64_t bytes = 0;
+        for(auto & part: parts) bytes += part.bytes;
+        uint64_t padded = (bytes + 7) & ~uint64_t(7);
+        ChunkHeader header{kind, key, padded};
+        uint64_t offset = recordOffset;
+        fwrite(&header, sizeof(header), 1, recordFile);
+        for(auto & part: parts) fwrite(part.data, 1, part.bytes, recordFile);
+        fwrite(zeros, 1, padded - bytes, recordFile);
+        recordOffset += sizeof(header) + padded;
+        return offset;
+    }
+
+    static void declareColumn(const Column & col, uint32_t subplot, uint32_t stream) {
+        std::string fig = subplotName(subplot), name = streamName(subplot, stream);
+        StreamHeader header{col.width, (uint16_t)fig.size(), (uint16_t)name.size()};
+        uint64_t offset = writeChunk(ChunkStream, col.key, {{&header, sizeof(header)}, {fig.data(), header.figLen}, {name.data(), header.nameLen}});
+        recordIndex.push_back(IndexEntry{col.key, 0, 0, 0, offset});
+    }
+
+    static void flushColumn(Column & col) {
+        if(col.time.empty()) return;
+        auto range = std::minmax_element(col.time.begin(), col.time.end());
+        BlockHeader header{(uint32_t)col.time.size(), col.width, *range.first, *range.second};
+        uint64_t offset = writeChunk(ChunkBlock, col.key, {{&header, sizeof(header)},
+            {col.time.data(), col.time.size() * sizeof(double)}, {col.value.data(), col.value.size() * sizeof(double)}});
+        recordIndex.push_back(IndexEntry{col.key, header.rows, header.tmin, header.tmax, offset});
+        col.time.clear();
+        col.value.clear();
+        recordBlocks++;
+    }
+
+    static void recordLoop() {
+        std::unordered_map<uint64_t, Column> columns;
+        std::vector<SampleBatch> batches;
+        uint32_t nextKey = 0;
+        auto lastFlush = std::chrono::steady_clock::now();
+        for(;;) {
+            bool stop = !recording;
+            batches.clear();
+            recordQueue.popBatch(batches);
+            for(auto & batch: batches) {
+                for(auto & rec: batch.records) {
+                    if(rec.stream == NoStream) continue;
+                    uint64_t id = (uint64_t(rec.subplot) << 32) | rec.stream;
+                    auto it = columns.find(id);
+                    if(it == columns.end() || it->second.width != rec.count) {
+                        if(it != columns.end()) flushColumn(it->second);
+                        it = columns.insert_or_assign(id, Column{nextKey++, rec.count, {}, {}}).first;
+                        declareColumn(it->second, rec.subplot, rec.stream);
+                    }
+                    Column & col = it->second;
+                    col.time.push_back(rec.time);
+                    col.value.insert(col.value.end(), batch.values.begin() + rec.offset, batch.values.begin() + rec.offset + rec.count);
+                    if(col.time.size() >= BlockRows) flushColumn(col);
+                    recordSamples++;
+                }
+            }
+            auto now = std::chrono::steady_clock::now();
+            if(stop || now - lastFlush > std::chrono::seconds(1)) {
+                for(auto & col: columns) flushColumn(col.second);
+                fflush(recordFile);
+                lastFlush = now;
+            }
+            if(stop) break;
+            if(batches.empty()) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        Footer footer{recordOffset, {}};
+        memcpy(footer.magic, IndexMagic, sizeof(footer.magic));
+        writeChunk(ChunkIndex, 0, {{recordIndex.data(), recordIndex.size() * sizeof(IndexEntry)}});
+        fwrite(&footer, sizeof(footer), 1, recordFile);
+        fclose(recordFile);
+        recordFile = nullptr;
+    }
+
+    bool initRecorder(const std::string & path) {
+        recordFile = fopen(path.c_str(), "wb");
+        if(!recordFile) {
+            std::cout << "Failed to create recording " << path << std::endl;
+            return false;
+        }
+        setvbuf(recordFile, nullptr, _IOFBF, 1 << 20);
+        FileHeader header{{}, 1, 0};
+        memcpy(header.magic, RecordMagic, sizeof(header.magic));
+        fwrite(&header, sizeof(header), 1, recordFile);
+        recordOffset = sizeof(header);
+        recordIndex.clear();
+        recording = true;
+        recordThread = std::thread(recordLoop);
+        return true;
+    }
+
+    void stopRecorder() {
+        if(!recording) return;
+        recording = false;
+        recordThread.join();
+    }
+
+    void recordBatch(SampleBatch && batch) {
+        if(recording) recordQueue.push(std::move(batch));
+    }
+
+    RecorderStats recorderStats() {
+        return RecorderStats{recording.load(), recordSamples.load(), recordBlocks.load(), recordQueue.overflows()};
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // Reader
+
+    struct MappedFile {
+        const char * data{nullptr};
+        size_t size{0};
+#ifdef _WIN32
+        HANDLE file{INVALID_HANDLE_VALUE};
+        HANDLE mapping{nullptr};
+#endif
+
+        bool open(const std::string & path) {
+#ifdef _WIN32
+            file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if(file == INVALID_HANDLE_VALUE) return false;
+            LARGE_INTEGER len;
+            if(!GetFileSizeEx(file, &len) || len.QuadPart == 0) return false;
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if(!mapping) return false;
+            data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            size = (size_t)len.QuadPart;
+            return data != nullptr;
+#else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0) return false;
+            struct stat st;
+            if(fstat(fd, &st) != 0 || st.st_size == 0) {
+                ::close(fd);
+                return false;
+            }
+            void * p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if(p == MAP_FAILED) return false;
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            data = (const char *)p;
+            size = st.st_size;
+            return true;
+#endif
+        }
+
+        ~MappedFile() {
+#ifdef _WIN32
+            if(data) UnmapViewOfFile(data);
+            if(mapping) CloseHandle(mapping);
+            if(file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+            if(data) munmap((void *)data, size);
+#endif
+        }
+    };
+
+    struct ReplayStream {
+        uint32_t subplot{0}, stream{0}, width{0};
+        std::vector<const BlockHeader *> blocks;
+        size_t block{0}, row{0};
+
+        bool done() const { return block >= blocks.size(); }
+        double nextTime() const { return ((const double *)(blocks[block] + 1))[row]; }
+    };
+
+    // The chunk at `offset` if its header and payload lie inside the file.
+    static const ChunkHeader * chunkAt(const MappedFile & file, uint64_t offset) {
+        if(offset % 8 != 0 || offset > file.size || file.size - offset < sizeof(ChunkHeader)) return nullptr;
+        auto header = (const ChunkHeader *)(file.data + offset);
+        if(header->bytes > file.size - offset - sizeof(ChunkHeader)) return nullptr;
+        return header;
+    }
+
+    // Whether a stream or block chunk holds everything its own header promises.
+    static bool validChunk(const ChunkHeader * header) {
+        if(header->kind == ChunkStream) {
+            if(header->bytes < sizeof(StreamHeader)) return false;
+            auto decl = (const StreamHeader *)(header + 1);
+            return decl->width > 0 && header->bytes - sizeof(StreamHeader) >= uint64_t(decl->figLen) + decl->nameLen;
+        }
+        if(header->kind == ChunkBlock) {
+            if(header->bytes < sizeof(BlockHeader)) return false;
+            auto block = (const BlockHeader *)(header + 1);
+            // Both factors fit in 32 bits, so the product can not overflow.
+            uint64_t values = uint64_t(block->rows) * (uint64_t(block->width) + 1);
+            return block->rows > 0 && block->width > 0 && values <= (header->bytes - sizeof(BlockHeader)) / sizeof(double);
+        }
+        return true;
+    }
+
+    // Reads the index of a cleanly closed recording. Fails if there is none
+    // or any entry does not match the chunk it points to.
+    static bool readIndex(const MappedFile & file, std::vector<IndexEntry> & entries) {
+        if(file.size < sizeof(FileHeader) + sizeof(Footer)) return false;
+        Footer footer;
+        memcpy(&footer, file.data + file.size - sizeof(Footer), sizeof(Footer));
+        if(memcmp(footer.magic, IndexMagic, sizeof(IndexMagic)) != 0) return false;
+        auto header = chunkAt(file, footer.index);
+        if(!header || header->kind != ChunkIndex) return false;
+        auto first = (const IndexEntry *)(header + 1);
+        entries.assign(first, first + header->bytes / sizeof(IndexEntry));
+        for(auto & entry: entries) {
+            auto chunk = chunkAt(file, entry.offset);
+            if(!chunk || !validChunk(chunk) || chunk->key != entry.key) return false;
+            if(entry.rows == 0 && chunk->kind != ChunkStream) return false;
+            if(entry.rows != 0 && (chunk->kind != ChunkBlock || ((const BlockHeader *)(chunk + 1))->rows != entry.rows)) return false;
+        }
+        return true;
+    }
+
+    // Walks the chunks of a recording that was not closed cleanly, up to the
+    // first one that is cut off or inconsistent.
+    static void scanChunks(const MappedFile & file, std::vector<IndexEntry> & entries) {
+        for(uint64_t offset = sizeof(FileHeader);;) {
+            auto header = chunkAt(file, offset);
+            if(!header || !validChunk(header)) break;
+            if(header->kind == ChunkStream) entries.push_back(IndexEntry{header->key, 0, 0, 0, offset});
+            if(header->kind == ChunkBlock) {
+                auto block = (const BlockHeader *)(header + 1);
+                entries.push_back(IndexEntry{header->key, block->rows, block->tmin, block->tmax, offset});
+            }
+            offset += sizeof(ChunkHeader) + header->bytes;
+        }
+    }
+
+    // Collects the stream declarations and blocks of a mapped recording, from
+    // the index when the file was closed cleanly and by walking the chunks
+    // otherwise. Every chunk is checked against the file size first.
+    static bool loadRecording(const MappedFile & file, std::vector<ReplayStream> & streams) {
+        if(file.size < sizeof(FileHeader) || memcmp(file.data, RecordMagic, sizeof(RecordMagic)) != 0) return false;
+        std::vector<IndexEntry> entries;
+        if(!readIndex(file, entries)) {
+            std::cout << "Recording has no valid index, scanning it" << std::endl;
+            entries.clear();
+            scanChunks(file, entries);
+        }
+        // Keys come from the file, so they are mapped instead of used as indices.
+        std::unordered_map<uint32_t, size_t> slots;
+        for(auto & entry: entries) {
+            auto header = (const ChunkHeader *)(file.data + entry.offset);
+            auto slot = slots.emplace(entry.key, streams.size());
+            if(slot.second) streams.emplace_back();
+            ReplayStream & st = streams[slot.first->second];
+            if(entry.rows == 0) {
+                auto decl = (const StreamHeader *)(header + 1);
+                const char * names = (const char *)(decl + 1);
+                st.width = decl->width;
+                st.subplot = internSubplot(std::string_view(names, decl->figLen));
+                st.stream = internStream(st.subplot, std::string_view(names + decl->figLen, decl->nameLen));
+            }
+            else {
+                auto block = (const BlockHeader *)(header + 1);
+                // Blocks of an undeclared stream or with another width are skipped.
+                if(block->width == st.width) st.blocks.push_back(block);
+            }
+        }
+        for(auto & st: streams) {
+            std::stable_sort(st.blocks.begin(), st.blocks.end(), [](const BlockHeader * a, const BlockHeader * b) { return a->tmin < b->tmin; });
+        }
+        return true;
+    }
+
+    static std::thread replayThread;
+    static std::atomic<bool> replaying{false};
+
+    static void replayLoop(std::string path, double speed) {
+        MappedFile file;
+        std::vector<ReplayStream> streams;
+        if(!file.open(path) || !loadRecording(file, streams)) {
+            std::cout << "Failed to open recording " << path << std::endl;
+            return;
+        }
+        // Recording time covered by one pushed batch.
+        const double slice = speed > 0 ? 0.01 * speed : 0.1;
+        double start = 1e300;
+        for(auto & st: streams) {
+            if(!st.done()) start = std::min(start, st.nextTime());
+        }
+        auto wallStart = std::chrono::steady_clock::now();
+        double t = start;
+        uint64_t samples = 0;
+        while(replaying) {
+            double end = t + slice;
+            SampleBatch batch;
+            bool left = false;
+            double next = 1e300;
+            for(auto & st: streams) {
+                while(!st.done()) {
+                    auto block = st.blocks[st.block];
+                    auto times = (const double *)(block + 1);
+                    auto values = times + block->rows;
+                    if(times[st.row] >= end) break;
+                    batch.add(st.subplot, st.stream, times[st.row], values + size_t(st.row) * block->width, block->width);
+                    if(++st.row == block->rows) {
+                        st.block++;
+                        st.row = 0;
+                    }
+                }
+                if(!st.done()) {
+                    left = true;
+                    next = std::min(next, st.nextTime());
+                }
+            }
+            samples += batch.records.size();
+            while(!batch.empty() && replaying && !pushQueue(std::move(batch))) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            if(!left) break;
+            t = std::max(end, next < end + slice ? end : next);
+            if(speed > 0) {
+                std::this_thread::sleep_until(wallStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>((t - start) / speed)));
+            }
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+        std::cout << "Replayed " << samples << " samples from " << path << " in " << elapsed << " s" << std::endl;
+    }
+
+    bool initReplay(const std::string & path, double speed) {
+        replaying = true;
+        replayThread = std::thread(replayLoop, path, speed);
+        return true;
+    }
+
+    void stopReplay() {
+        replaying = false;
+        if(replayThread.joinable()) replayThread.join();
+    }
+
+} // namespace ipip
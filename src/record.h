@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "sample.h"
+
+namespace ipip {
+
+    // Session recording (.ipr): an append-only log of column blocks per stream.
+    //   header  : char[8] "IPIPREC", u32 version (1), u32 0
+    //   chunk   : u32 kind, u32 stream key, u64 payload bytes, payload padded to 8
+    //     kind 1: stream   u32 width, u16 figure length, u16 name length, names
+    //     kind 2: block    u32 rows, u32 width, f64 tmin, f64 tmax,
+    //                      f64 time[rows], f64 value[rows][width]
+    //     kind 3: index    { u32 key, u32 rows, f64 tmin, f64 tmax, u64 offset }[]
+    //   footer  : u64 index chunk offset, char[8] "IPIPIDX"
+    // The index and footer are only written on a clean stop; a file without
+    // them is still replayable by scanning the chunks.
+
+    struct RecorderStats {
+        bool active;
+        uint64_t samples;
+        uint64_t blocks;
+        uint64_t dropped;
+    };
+
+    // Starts the background writer. Returns false if the file can not be created.
+    bool initRecorder(const std::string & path);
+    void stopRecorder();
+    // Hands an already ingested batch to the writer. Never blocks; when the
+    // writer falls behind the batch is dropped and counted.
+    void recordBatch(SampleBatch && batch);
+    RecorderStats recorderStats();
+
+    // Re-feeds a recording through the ingest queue at `speed` times real time,
+    // or as fast as the queue drains when speed <= 0.
+    bool initReplay(const std::string & path, double speed);
+    void stopReplay();
+
+} // namespace ipip
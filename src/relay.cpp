@@ -0,0 +1,215 @@
+#include "relay.h"
+#include "queue.h"
+#include <httplib.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ipip {
+
+    static MpscRing<SampleBatch> relayQueue(1 << 12);
+    static std::thread relayThread;
+    static std::atomic<bool> relaying{false}, relayConnected{false};
+    static std::atomic<uint64_t> relaySamples{0}, relayDropped{0}, relayReconnects{0};
+
+    // Turns batches back into NDJSON documents, one per distinct time, with
+    // the quoted names cached per id.
+    struct RelayEncoder {
+        std::string prefix;
+        double interval;
+        std::unordered_map<uint32_t, std::string> figures;
+        std::unordered_map<uint64_t, std::string> streams;
+        std::unordered_map<uint64_t, double> last;
+        std::string out;
+        uint64_t pending{0};
+
+        static void quote(std::string & out, const std::string & s) {
+            out += '"';
+            for(char c: s) {
+                if(c == '"' || c == '\\') out += '\\';
+                if((unsigned char)c < 0x20) {
+                    char buf[8];
+                    out.append(buf, snprintf(buf, sizeof(buf), "\\u%04x", c));
+                    continue;
+                }
+                out += c;
+            }
+            out += '"';
+        }
+
+        void number(double v) {
+            if(!std::isfinite(v)) {
+                out += "null";
+                return;
+            }
+            char buf[32];
+            out.append(buf, snprintf(buf, sizeof(buf), "%.17g", v));
+        }
+
+        const std::string & figure(uint32_t subplot) {
+            auto it = figures.find(subplot);
+            if(it != figures.end()) return it->second;
+            std::string & name = figures[subplot];
+            quote(name, subplotName(subplot));
+            return name;
+        }
+
+        const std::string & stream(uint32_t subplot, uint32_t stream) {
+            uint64_t key = (uint64_t(subplot) << 32) | stream;
+            auto it = streams.find(key);
+            if(it != streams.end()) return it->second;
+            std::string & name = streams[key];
+            quote(name, prefix + streamName(subplot, stream));
+            return name;
+        }
+
+        void encode(const SampleBatch & batch) {
+            bool inDoc = false, inFigure = false;
+            double docTime = 0;
+            uint32_t current = 0;
+            for(auto & rec: batch.records) {
+                if(interval > 0 && rec.stream != NoStream) {
+                    auto slot = last.try_emplace((uint64_t(rec.subplot) << 32) | rec.stream, -INFINITY).first;
+                    if(rec.time - slot->second < interval) continue;
+                    slot->second = rec.time;
+                }
+                if(!inDoc || rec.time != docTime) {
+                    if(inFigure) out += '}';
+                    if(inDoc) out += "}\n";
+                    out += "{\"time\":";
+                    number(rec.time);
+                    inDoc = true;
+                    inFigure = false;
+                    docTime = rec.time;
+                }
+                if(rec.stream == NoStream) {
+                    if(inFigure) out += '}';
+                    inFigure = false;
+                    out += ',';
+                    out += figure(rec.subplot);
+                    out += ":null";
+                    continue;
+                }
+                if(!inFigure || rec.subplot != current) {
+                    if(inFigure) out += '}';
+                    out += ',';
+                    out += figure(rec.subplot);
+                    out += ":{";
+                    inFigure = true;
+                    current = rec.subplot;
+                }
+                else {
+                    out += ',';
+                }
+                out += stream(rec.subplot, rec.stream);
+                out += ':';
+                const double * v = batch.values.data() + rec.offset;
+                if(rec.count == 1) {
+                    number(v[0]);
+                }
+                else {
+                    out += '[';
+                    for(uint32_t i = 0; i < rec.count; i++) {
+                        if(i) out += ',';
+                        number(v[i]);
+                    }
+                    out += ']';
+                }
+                pending++;
+            }
+            if(inFigure) out += '}';
+            if(inDoc) out += "}\n";
+        }
+    };
+
+    static void dropQueued() {
+        SampleBatch batch;
+        while(relayQueue.pop(batch)) relayDropped += batch.records.size();
+    }
+
+    static void relayLoop(std::string url, RelayEncoder encoder) {
+        const size_t FlushBytes = 64 << 10;
+        const auto FlushInterval = std::chrono::milliseconds(20);
+        // Below the upstream read timeout (5 s), so an idle upload stays open.
+        const auto KeepAlive = std::chrono::seconds(2);
+        std::vector<SampleBatch> batches;
+        while(relaying) {
+            httplib::Client cli(url);
+            cli.set_write_timeout(10);
+            auto lastWrite = std::chrono::steady_clock::now();
+            cli.Post("/", [&](size_t, httplib::DataSink & sink) {
+                if(!relaying) {
+                    sink.done();
+                    return true;
+                }
+                relayConnected = true;
+                batches.clear();
+                relayQueue.popBatch(batches, 256);
+                for(auto & batch: batches) encoder.encode(batch);
+                auto now = std::chrono::steady_clock::now();
+                bool due = encoder.out.size() >= FlushBytes || (!encoder.out.empty() && now - lastWrite >= FlushInterval);
+                if(!due && now - lastWrite >= KeepAlive) {
+                    encoder.out += '\n';
+                    due = true;
+                }
+                if(!due) {
+                    if(batches.empty()) std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                    return true;
+                }
+                bool ok = sink.write(encoder.out.data(), encoder.out.size());
+                (ok ? relaySamples : relayDropped) += encoder.pending;
+                encoder.out.clear();
+                encoder.pending = 0;
+                lastWrite = now;
+                return ok;
+            }, "application/x-ndjson");
+            relayConnected = false;
+            relayDropped += encoder.pending;
+            encoder.out.clear();
+            encoder.pending = 0;
+            if(!relaying) break;
+            relayReconnects++;
+            std::cout << "Relay to " << url << " failed, retrying" << std::endl;
+            for(int i = 0; i < 100 && relaying; i++) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                dropQueued();
+            }
+        }
+        dropQueued();
+    }
+
+    bool initRelay(const std::string & url, const std::string & name, double rate) {
+        if(url.rfind("http://", 0) != 0) {
+            std::cout << "Relay target must look like http://host:port, got " << url << std::endl;
+            return false;
+        }
+        RelayEncoder encoder;
+        encoder.prefix = name + "/";
+        encoder.interval = rate > 0 ? 1 / rate : 0;
+        relaying = true;
+        relayThread = std::thread(relayLoop, url, std::move(encoder));
+        return true;
+    }
+
+    void stopRelay() {
+        if(!relaying) return;
+        relaying = false;
+        relayThread.join();
+    }
+
+    void relayBatch(const SampleBatch & batch) {
+        if(!relaying) return;
+        SampleBatch copy = batch;
+        if(!relayQueue.push(std::move(copy))) relayDropped += batch.records.size();
+    }
+
+    RelayStats relayStats() {
+        return RelayStats{relaying.load(), relayConnected.load(), relaySamples.load(), relayDropped.load(), relayReconnects.load()};
+    }
+
+} // namespace ipip
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "sample.h"
+
+namespace ipip {
+
+    // Forwarding to an upstream ipip, for aggregating many instances into one.
+    // Every ingested sample is re-sent as NDJSON over one long-lived chunked
+    // POST, with stream names prefixed by "<name>/", so the upstream shows
+    // all sources side by side in the same figures. The connection is
+    // re-established when it drops; samples arriving meanwhile are dropped.
+
+    struct RelayStats {
+        bool active;
+        bool connected;
+        uint64_t samples;
+        uint64_t dropped;
+        uint64_t reconnects;
+    };
+
+    // `url` is "http://host:port". With `rate` > 0 at most that many samples
+    // per stream and second are forwarded.
+    bool initRelay(const std::string & url, const std::string & name, double rate);
+    void stopRelay();
+    // Hands a fed batch to the forwarder; copies it and never blocks.
+    void relayBatch(const SampleBatch & batch);
+    RelayStats relayStats();
+
+} // namespace ipip
@@ -0,0 +1,579 @@
+#include "sample.h"
+#include "help.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace ipip {
+
+    // Hashed name -> id index. Names live in a deque so the string_view keys
+    // stay valid as the table grows, and lookups never allocate.
+    struct NameTable {
+        std::unordered_map<std::string_view, uint32_t> ids;
+        std::deque<std::string> names;
+
+        uint32_t find(std::string_view name) const {
+            auto it = ids.find(name);
+            return it == ids.end() ? NoStream : it->second;
+        }
+
+        uint32_t insert(std::string_view name) {
+            uint32_t id = find(name);
+            if(id != NoStream) return id;
+            id = names.size();
+            names.emplace_back(name);
+            ids.emplace(names.back(), id);
+            return id;
+        }
+    };
+
+    static std::shared_mutex tableLock;
+    static NameTable subplotTable;
+    static std::deque<NameTable> streamTables;
+
+    uint32_t internSubplot(std::string_view name) {
+        {
+            std::shared_lock<std::shared_mutex> guard(tableLock);
+            uint32_t id = subplotTable.find(name);
+            if(id != NoStream) return id;
+        }
+        std::unique_lock<std::shared_mutex> guard(tableLock);
+        uint32_t id = subplotTable.insert(name);
+        if(id >= streamTables.size()) streamTables.resize(id + 1);
+        return id;
+    }
+
+    uint32_t internStream(uint32_t subplot, std::string_view name) {
+        {
+            std::shared_lock<std::shared_mutex> guard(tableLock);
+            uint32_t id = streamTables[subplot].find(name);
+            if(id != NoStream) return id;
+        }
+        std::unique_lock<std::shared_mutex> guard(tableLock);
+        return streamTables[subplot].insert(name);
+    }
+
+    static uint32_t findSubplot(std::string_view name) {
+        std::shared_lock<std::shared_mutex> guard(tableLock);
+        return subplotTable.find(name);
+    }
+
+    static uint32_t findStream(uint32_t subplot, std::string_view name) {
+        std::shared_lock<std::shared_mutex> guard(tableLock);
+        return streamTables[subplot].find(name);
+    }
+
+    // Resolves names while a body is parsed. Names not in the tables yet get
+    // provisional ids and are interned by commit() once the whole body
+    // parsed, so rejected input never grows the tables.
+    struct NameResolver {
+        static const uint32_t Provisional = 0x80000000u;
+
+        std::unordered_map<std::string, uint32_t> figures;
+        // Keyed by the (possibly provisional) subplot id bytes, then the name.
+        std::unordered_map<std::string, uint32_t> streams;
+
+        uint32_t subplot(std::string_view name) {
+            uint32_t id = findSubplot(name);
+            if(id != NoStream) return id;
+            auto it = figures.emplace(std::string(name), Provisional | (uint32_t)figures.size()).first;
+            return it->second;
+        }
+
+        uint32_t stream(uint32_t subplot, std::string_view name) {
+            if(!(subplot & Provisional)) {
+                uint32_t id = findStream(subplot, name);
+                if(id != NoStream) return id;
+            }
+            std::string key(reinterpret_cast<const char *>(&subplot), sizeof(subplot));
+            key += name;
+            auto it = streams.emplace(std::move(key), Provisional | (uint32_t)streams.size()).first;
+            return it->second;
+        }
+
+        // Interns the new names and rewrites the provisional ids of the
+        // records from `first` on.
+        void commit(SampleBatch & batch, size_t first) {
+            if(figures.empty() && streams.empty()) return;
+            // In order of appearance, as if interned while parsing.
+            std::vector<const std::string *> figureOrder(figures.size()), streamOrder(streams.size());
+            for(auto & fig: figures) figureOrder[fig.second & ~Provisional] = &fig.first;
+            for(auto & st: streams) streamOrder[st.second & ~Provisional] = &st.first;
+            std::vector<uint32_t> subplots(figures.size()), ids(streams.size());
+            for(size_t i = 0; i < subplots.size(); i++) subplots[i] = internSubplot(*figureOrder[i]);
+            auto real = [&](uint32_t subplot) { return subplot & Provisional ? subplots[subplot & ~Provisional] : subplot; };
+            for(size_t i = 0; i < ids.size(); i++) {
+                uint32_t subplot;
+                memcpy(&subplot, streamOrder[i]->data(), sizeof(subplot));
+                ids[i] = internStream(real(subplot), std::string_view(*streamOrder[i]).substr(sizeof(subplot)));
+            }
+            for(size_t i = first; i < batch.records.size(); i++) {
+                SampleRecord & r = batch.records[i];
+                r.subplot = real(r.subplot);
+                if(r.stream != NoStream && (r.stream & Provisional)) r.stream = ids[r.stream & ~Provisional];
+            }
+        }
+    };
+
+    std::string subplotName(uint32_t subplot) {
+        std::shared_lock<std::shared_mutex> guard(tableLock);
+        return subplotTable.names[subplot];
+    }
+
+    std::string streamName(uint32_t subplot, uint32_t stream) {
+        std::shared_lock<std::shared_mutex> guard(tableLock);
+        return streamTables[subplot].names[stream];
+    }
+
+    static void parseValue(const Json::Value & value, uint32_t subplot, uint32_t stream, double time, SampleBatch & batch) {
+        ipipAssert(value.isArray() || value.isNumeric(), "Invalid data", value);
+        uint32_t offset = batch.values.size();
+        if(value.isArray()) {
+            for(Json::ArrayIndex i = 0; i < value.size(); i++) {
+                ipipAssert(value[i].isNumeric(), "Invalid data", value);
+                batch.values.push_back(value[i].asDouble());
+            }
+        }
+        else {
+            batch.values.push_back(value.asDouble());
+        }
+        batch.records.push_back(SampleRecord{subplot, stream, time, offset, (uint32_t)batch.values.size() - offset});
+    }
+
+    void parseSample(const Json::Value & data, SampleBatch & batch) {
+        ipipAssert(data.isObject() && data.isMember("time") && data["time"].isNumeric(), "time not found", data);
+        size_t records = batch.records.size(), values = batch.values.size();
+        NameResolver names;
+        try {
+            double tm = data["time"].asDouble();
+            for(auto fig = data.begin(); fig != data.end(); ++fig) {
+                const char * end;
+                const char * begin = fig.memberName(&end);
+                std::string_view figName(begin, end - begin);
+                if(figName == "time") continue;
+                uint32_t subplot = names.subplot(figName);
+                size_t before = batch.records.size();
+                if(fig->isObject()) {
+                    for(auto it = fig->begin(); it != fig->end(); ++it) {
+                        if(it->isNull()) continue;
+                        begin = it.memberName(&end);
+                        parseValue(*it, subplot, names.stream(subplot, std::string_view(begin, end - begin)), tm, batch);
+                    }
+                }
+                else if(!fig->isNull()) {
+                    parseValue(*fig, subplot, names.stream(subplot, "data"), tm, batch);
+                }
+                if(batch.records.size() == before) {
+                    batch.records.push_back(SampleRecord{subplot, NoStream, tm, (uint32_t)batch.values.size(), 0});
+                }
+            }
+        }
+        catch(...) {
+            batch.records.resize(records);
+            batch.values.resize(values);
+            throw;
+        }
+        names.commit(batch, records);
+    }
+
+    // Single pass parser for the sample format: documents are scanned once,
+    // names resolve straight to (maybe provisional) ids and numbers go
+    // straight into the batch.
+    // No DOM is built; escaped names are decoded into reusable scratch.
+    struct SampleScanner {
+        const char * begin;
+        const char * pos;
+        const char * end;
+        SampleBatch & batch;
+        std::string & scratch;
+        NameResolver & names;
+
+        [[noreturn]] void fail(const char * what) const {
+            long line = 1 + std::count(begin, pos, '\n');
+            throw std::runtime_error(std::string(what) + " at byte " + std::to_string(pos - begin) + " (line " + std::to_string(line) + ")");
+        }
+
+        void ws() {
+            while(pos < end && (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t')) pos++;
+        }
+
+        bool next(char c) {
+            ws();
+            if(pos < end && *pos == c) {
+                pos++;
+                return true;
+            }
+            return false;
+        }
+
+        void expect(char c, const char * what) {
+            if(!next(c)) fail(what);
+        }
+
+        bool null() {
+            ws();
+            if(end - pos >= 4 && memcmp(pos, "null", 4) == 0) {
+                pos += 4;
+                return true;
+            }
+            return false;
+        }
+
+        static int hex(char c) {
+            if(c >= '0' && c <= '9') return c - '0';
+            if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        }
+
+        uint32_t codeUnit() {
+            uint32_t u = 0;
+            for(int i = 0; i < 4; i++) {
+                int h = pos < end ? hex(*pos) : -1;
+                if(h < 0) fail("Bad \\u escape");
+                u = u * 16 + h;
+                pos++;
+            }
+            return u;
+        }
+
+        void utf8(uint32_t cp) {
+            if(cp < 0x80) {
+                scratch += char(cp);
+            }
+            else if(cp < 0x800) {
+                scratch += char(0xC0 | (cp >> 6));
+                scratch += char(0x80 | (cp & 0x3F));
+            }
+            else if(cp < 0x10000) {
+                scratch += char(0xE0 | (cp >> 12));
+                scratch += char(0x80 | ((cp >> 6) & 0x3F));
+                scratch += char(0x80 | (cp & 0x3F));
+            }
+            else {
+                scratch += char(0xF0 | (cp >> 18));
+                scratch += char(0x80 | ((cp >> 12) & 0x3F));
+                scratch += char(0x80 | ((cp >> 6) & 0x3F));
+                scratch += char(0x80 | (cp & 0x3F));
+            }
+        }
+
+        // A view into the body, or into `scratch` when the string has escapes.
+        std::string_view string() {
+            expect('"', "Expected a name");
+            const char * start = pos;
+            while(pos < end && *pos != '"' && *pos != '\\' && (unsigned char)*pos >= 0x20) pos++;
+            if(pos < end && *pos == '"') {
+                return std::string_view(start, pos++ - start);
+            }
+            scratch.assign(start, pos);
+            for(;;) {
+                if(pos >= end) fail("Unterminated string");
+                char c = *pos;
+                if((unsigned char)c < 0x20) fail("Control character in string");
+                pos++;
+                if(c == '"') break;
+                if(c != '\\') {
+                    scratch += c;
+                    continue;
+                }
+                if(pos >= end) fail("Unterminated string");
+                switch(char e = *pos++) {
+                case '"': case '\\': case '/': scratch += e; break;
+                case 'b': scratch += '\b'; break;
+                case 'f': scratch += '\f'; break;
+                case 'n': scratch += '\n'; break;
+                case 'r': scratch += '\r'; break;
+                case 't': scratch += '\t'; break;
+                case 'u': {
+                    uint32_t cp = codeUnit();
+                    if(cp >= 0xD800 && cp < 0xDC00 && end - pos >= 2 && pos[0] == '\\' && pos[1] == 'u') {
+                        pos += 2;
+                        uint32_t low = codeUnit();
+                        if(low < 0xDC00 || low >= 0xE000) fail("Bad surrogate pair");
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    utf8(cp);
+                    break;
+                }
+                default:
+                    pos--;
+                    fail("Bad escape");
+                }
+            }
+            return scratch;
+        }
+
+        double number(const char * what) {
+            static const double pow10[] = {
+                1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+            };
+            ws();
+            const char * start = pos;
+            bool neg = pos < end && *pos == '-';
+            if(neg) pos++;
+            if(pos >= end || !isdigit((unsigned char)*pos)) {
+                pos = start;
+                fail(what);
+            }
+            uint64_t mant = 0;
+            int digits = 0, exp10 = 0;
+            auto digit = [&](int d, bool fraction) {
+                if(mant == 0 && d == 0) {
+                    exp10 -= fraction;
+                }
+                else if(digits < 19) {
+                    mant = mant * 10 + d;
+                    digits++;
+                    exp10 -= fraction;
+                }
+                else {
+                    digits++;
+                    exp10 += !fraction;
+                }
+            };
+            if(*pos == '0') pos++;
+            else while(pos < end && isdigit((unsigned char)*pos)) digit(*pos++ - '0', false);
+            if(pos < end && *pos == '.') {
+                pos++;
+                if(pos >= end || !isdigit((unsigned char)*pos)) fail("Bad number");
+                while(pos < end && isdigit((unsigned char)*pos)) digit(*pos++ - '0', true);
+            }
+            if(pos < end && (*pos == 'e' || *pos == 'E')) {
+                pos++;
+                bool eneg = pos < end && *pos == '-';
+                if(pos < end && (*pos == '-' || *pos == '+')) pos++;
+                if(pos >= end || !isdigit((unsigned char)*pos)) fail("Bad number");
+                int e = 0;
+                while(pos < end && isdigit((unsigned char)*pos)) e = std::min(e * 10 + (*pos++ - '0'), 100000);
+                exp10 += eneg ? -e : e;
+            }
+            double v;
+            if(digits <= 15 && exp10 >= -22 && exp10 <= 22) {
+                // Exact: both operands are representable, one rounding.
+                v = exp10 < 0 ? double(mant) / pow10[-exp10] : double(mant) * pow10[exp10];
+            }
+            else {
+                char buf[64];
+                size_t len = pos - start;
+                std::string big;
+                const char * text = buf;
+                if(len < sizeof(buf)) {
+                    memcpy(buf, start, len);
+                    buf[len] = 0;
+                }
+                else {
+                    big.assign(start, pos);
+                    text = big.c_str();
+                }
+                return strtod(text, nullptr);
+            }
+            return neg ? -v : v;
+        }
+
+        void value(uint32_t subplot, uint32_t stream) {
+            uint32_t offset = batch.values.size();
+            if(next('[')) {
+                if(!next(']')) {
+                    do batch.values.push_back(number("Invalid data"));
+                    while(next(','));
+                    expect(']', "Expected ',' or ']'");
+                }
+            }
+            else {
+                batch.values.push_back(number("Invalid data"));
+            }
+            batch.records.push_back(SampleRecord{subplot, stream, 0, offset, (uint32_t)batch.values.size() - offset});
+        }
+
+        void figure(uint32_t subplot) {
+            size_t before = batch.records.size();
+            if(next('{')) {
+                if(!next('}')) {
+                    do {
+                        std::string_view name = string();
+                        expect(':', "Expected ':'");
+                        if(null()) continue;
+                        value(subplot, names.stream(subplot, name));
+                    } while(next(','));
+                    expect('}', "Expected ',' or '}'");
+                }
+            }
+            else if(!null()) {
+                value(subplot, names.stream(subplot, "data"));
+            }
+            if(batch.records.size() == before) {
+                batch.records.push_back(SampleRecord{subplot, NoStream, 0, (uint32_t)batch.values.size(), 0});
+            }
+        }
+
+        // One `{time: ..., fig: {...}}` document; time may come in any position.
+        void document() {
+            size_t first = batch.records.size();
+            bool hasTime = false;
+            double time = 0;
+            expect('{', "Expected '{'");
+            if(!next('}')) {
+                do {
+                    std::string_view name = string();
+                    expect(':', "Expected ':'");
+                    if(name == "time") {
+                        time = number("time is not a number");
+                        hasTime = true;
+                    }
+                    else {
+                        figure(names.subplot(name));
+                    }
+                } while(next(','));
+                expect('}', "Expected ',' or '}'");
+            }
+            if(!hasTime) {
+                pos--;
+                fail("time not found");
+            }
+            for(size_t i = first; i < batch.records.size(); i++) {
+                batch.records[i].time = time;
+            }
+        }
+    };
+
+    void parseBody(const char * begin, const char * end, SampleBatch & batch) {
+        static thread_local std::string scratch;
+        size_t records = batch.records.size(), values = batch.values.size();
+        NameResolver names;
+        SampleScanner in{begin, begin, end, batch, scratch, names};
+        try {
+            in.ws();
+            ipipAssert(in.pos < end, "Empty body");
+            // A document, an array of documents, or several of either separated by whitespace (NDJSON).
+            while(in.pos < end) {
+                if(in.next('[')) {
+                    if(!in.next(']')) {
+                        do in.document();
+                        while(in.next(','));
+                        in.expect(']', "Expected ',' or ']'");
+                    }
+                }
+                else {
+                    in.document();
+                }
+                in.ws();
+            }
+        }
+        catch(...) {
+            batch.records.resize(records);
+            batch.values.resize(values);
+            throw;
+        }
+        names.commit(batch, records);
+    }
+
+    struct FrameReader {
+        const char * begin;
+        const char * pos;
+        const char * end;
+
+        void need(size_t n, const char * what) {
+            ipipAssert(size_t(end - pos) >= n, "Truncated frame at byte ", pos - begin, ": expected ", what);
+        }
+
+        template<class T> T read(const char * what) {
+            T value;
+            need(sizeof(T), what);
+            memcpy(&value, pos, sizeof(T));
+            pos += sizeof(T);
+            return value;
+        }
+
+        std::string_view readName(const char * what) {
+            uint16_t len = read<uint16_t>(what);
+            need(len, what);
+            std::string_view name(pos, len);
+            pos += len;
+            return name;
+        }
+    };
+
+    struct FrameStream {
+        std::string_view figure, name;
+        uint32_t subplot, stream, width;
+        uint8_t dtype;
+    };
+
+    void parseFrame(const char * begin, const char * end, SampleBatch & batch) {
+        FrameReader in{begin, begin, end};
+        in.need(sizeof(FrameMagic), "magic");
+        ipipAssert(memcmp(in.pos, FrameMagic, sizeof(FrameMagic)) == 0, "Bad frame magic");
+        in.pos += sizeof(FrameMagic);
+        uint8_t version = in.read<uint8_t>("version");
+        ipipAssert(version == 1, "Unsupported frame version ", (int)version);
+        in.read<uint8_t>("flags");
+        uint16_t nstream = in.read<uint16_t>("stream count");
+        uint32_t nrow = in.read<uint32_t>("row count");
+
+        std::vector<FrameStream> streams(nstream);
+        for(auto & st: streams) {
+            size_t at = in.pos - begin;
+            st.figure = in.readName("figure name");
+            st.name = in.readName("stream name");
+            st.dtype = in.read<uint8_t>("dtype");
+            in.read<uint8_t>("reserved");
+            st.width = in.read<uint32_t>("width");
+            ipipAssert(st.dtype == 1 || st.dtype == 2, "Bad dtype ", (int)st.dtype, " at byte ", at);
+            ipipAssert(st.width > 0, "Zero width stream at byte ", at);
+            ipipAssert(st.figure != "time", "Figure can not be named time at byte ", at);
+        }
+
+        in.need(size_t(nrow) * sizeof(double), "time column");
+        const char * times = in.pos;
+        in.pos += size_t(nrow) * sizeof(double);
+        std::vector<const char *> blocks(nstream);
+        for(int i = 0; i < nstream; i++) {
+            size_t bytes = size_t(nrow) * streams[i].width * (streams[i].dtype == 1 ? sizeof(float) : sizeof(double));
+            in.need(bytes, "value block");
+            blocks[i] = in.pos;
+            in.pos += bytes;
+        }
+        ipipAssert(in.pos == end, "Trailing bytes after frame at byte ", in.pos - begin);
+        // Only a valid frame adds names to the tables.
+        for(auto & st: streams) {
+            st.subplot = internSubplot(st.figure);
+            st.stream = internStream(st.subplot, st.name);
+        }
+
+        batch.records.reserve(batch.records.size() + size_t(nrow) * nstream);
+        for(int i = 0; i < nstream; i++) {
+            auto & st = streams[i];
+            size_t base = batch.values.size();
+            size_t count = size_t(nrow) * st.width;
+            batch.values.resize(base + count);
+            double * dst = batch.values.data() + base;
+            if(st.dtype == 2) {
+                memcpy(dst, blocks[i], count * sizeof(double));
+            }
+            else {
+                for(size_t k = 0; k < count; k++) {
+                    float v;
+                    memcpy(&v, blocks[i] + k * sizeof(float), sizeof(float));
+                    dst[k] = v;
+                }
+            }
+            for(uint32_t r = 0; r < nrow; r++) {
+                if(st.width == 1 && std::isnan(dst[r])) continue;
+                double tm;
+                memcpy(&tm, times + r * sizeof(double), sizeof(double));
+                batch.records.push_back(SampleRecord{st.subplot, st.stream, tm, uint32_t(base + size_t(r) * st.width), st.width});
+            }
+        }
+    }
+
+} // namespace ipip
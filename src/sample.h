@@ -0,0 +1,69 @@
+#pragma once
+
+#include <json/json.h>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ipip {
+
+    const uint32_t NoStream = UINT32_MAX;
+
+    // One pre-resolved sample: values[offset, offset + count) of the owning
+    // batch belong to `stream` of `subplot` at `time`. A record with
+    // stream == NoStream only makes the subplot appear (a `null` figure).
+    struct SampleRecord {
+        uint32_t subplot;
+        uint32_t stream;
+        double time;
+        uint32_t offset;
+        uint32_t count;
+    };
+
+    // Flat, render-ready form of one or more posted documents.
+    struct SampleBatch {
+        std::vector<SampleRecord> records;
+        std::vector<double> values;
+
+        bool empty() const { return records.empty(); }
+
+        void clear() {
+            records.clear();
+            values.clear();
+        }
+
+        void add(uint32_t subplot, uint32_t stream, double time, const double * value, uint32_t count) {
+            records.push_back(SampleRecord{subplot, stream, time, (uint32_t)values.size(), count});
+            values.insert(values.end(), value, value + count);
+        }
+    };
+
+    // Name <-> id tables shared by the ingest threads and the render thread.
+    // Ids are dense and never reused, stream ids are per subplot.
+    uint32_t internSubplot(std::string_view name);
+    uint32_t internStream(uint32_t subplot, std::string_view name);
+    std::string subplotName(uint32_t subplot);
+    std::string streamName(uint32_t subplot, uint32_t stream);
+
+    // Appends the records of one `{time: ..., fig: {...}}` document to `batch`.
+    // Throws std::runtime_error on malformed input, leaving `batch` and the
+    // name tables unchanged.
+    void parseSample(const Json::Value & data, SampleBatch & batch);
+
+    // Parses a request body holding one document, a JSON array of documents
+    // or newline-delimited documents (NDJSON) in a single pass without a DOM.
+    // All or nothing, like parseSample; errors carry the byte offset.
+    void parseBody(const char * begin, const char * end, SampleBatch & batch);
+
+    // Binary columnar frame, all fields little-endian and byte packed:
+    //   char[4] magic "IPIP", u8 version (1), u8 flags (0),
+    //   u16 stream count S, u32 row count N,
+    //   S x { u16 len, figure name, u16 len, stream name, u8 dtype, u8 0, u32 width },
+    //   f64 time[N],
+    //   S x value block [N][width] of dtype (1 = f32, 2 = f64).
+    // A NaN in a width-1 stream is skipped like a JSON null.
+    const char FrameMagic[4] = {'I', 'P', 'I', 'P'};
+    void parseFrame(const char * begin, const char * end, SampleBatch & batch);
+
+} // namespace ipip
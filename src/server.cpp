@@ -1,58 +1,447 @@
 #include "server.h"
-#include <queue>
 #include <httplib.h>
 #include <sstream>
 #include "help.h"
 #include <thread>
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_map>
+#include "queue.h"
+#include "metrics.h"
+#include "derive.h"
+#include "snapshot.h"
 
 namespace ipip {
 
     static httplib::Server server;
     static std::thread httpThread;
-    static std::queue<Json::Value> serverQueue;
-    static std::mutex lock;
+    static std::thread udpThread;
+    static std::atomic<bool> udpRunning{false};
+    static std::atomic<uint64_t> udpReceived{0}, udpMalformed{0}, udpDropped{0};
+    static MpscRing<SampleBatch> serverQueue(1 << 16);
 
-    bool popQueue(Json::Value & result) {
-        if(serverQueue.empty()) {
+    // Besides the batch count of the ring, the queue is bounded by the size
+    // of the queued samples, so a few huge posts can not exhaust memory.
+    static const size_t MaxQueuedBytes = size_t(256) << 20;
+    static std::atomic<size_t> queuedBytes{0};
+    static std::atomic<uint64_t> bytesFull{0};
+    // Longest NDJSON line a stream may send; its bytes are buffered until '\n'.
+    static const size_t MaxStreamLine = size_t(16) << 20;
+
+    static std::atomic<int> overflowPolicy{OverflowReject};
+    static std::mutex coalesceLock;
+    // While set, every push goes into `coalesced` until popQueue hands it
+    // out, so nothing newer can overtake it in the ring. `pushing` counts
+    // producers between checking the flag and finishing their ring push.
+    static std::atomic<bool> hasCoalesced{false};
+    static std::atomic<int> pushing{0};
+    static SampleBatch coalesced;
+    static std::unordered_map<uint64_t, uint32_t> coalescedIndex;
+    // Values of `coalesced` no record points at any more.
+    static size_t coalescedStale = 0;
+
+    void setOverflowPolicy(OverflowPolicy policy) {
+        overflowPolicy.store(policy, std::memory_order_relaxed);
+    }
+
+    static size_t batchBytes(const SampleBatch & batch) {
+        return batch.records.size() * sizeof(SampleRecord) + batch.values.size() * sizeof(double);
+    }
+
+    // Copies the live values of `coalesced` to a fresh array, once records
+    // that changed width left more stale values than live ones behind.
+    static void compactCoalesced() {
+        std::vector<double> values;
+        values.reserve(coalesced.values.size() - coalescedStale);
+        for(auto & rec: coalesced.records) {
+            uint32_t offset = (uint32_t)values.size();
+            values.insert(values.end(), coalesced.values.begin() + rec.offset, coalesced.values.begin() + rec.offset + rec.count);
+            rec.offset = offset;
+        }
+        coalesced.values.swap(values);
+        coalescedStale = 0;
+    }
+
+    // Overwrites the pending sample of every stream in `batch` with the newer one.
+    static void coalesce(const SampleBatch & batch) {
+        std::lock_guard<std::mutex> guard(coalesceLock);
+        for(auto & rec: batch.records) {
+            uint64_t key = (uint64_t(rec.subplot) << 32) | rec.stream;
+            auto it = coalescedIndex.find(key);
+            const double * values = batch.values.data() + rec.offset;
+            if(it == coalescedIndex.end()) {
+                coalescedIndex.emplace(key, (uint32_t)coalesced.records.size());
+                coalesced.add(rec.subplot, rec.stream, rec.time, values, rec.count);
+                continue;
+            }
+            SampleRecord & old = coalesced.records[it->second];
+            if(old.count != rec.count) {
+                coalescedStale += old.count;
+                old.offset = coalesced.values.size();
+                old.count = rec.count;
+                coalesced.values.resize(coalesced.values.size() + rec.count);
+            }
+            old.time = rec.time;
+            std::copy(values, values + rec.count, coalesced.values.begin() + old.offset);
+        }
+        if(coalescedStale > coalesced.values.size() / 2) compactCoalesced();
+        hasCoalesced.store(true);
+        metrics.queueCoalesced.add();
+    }
+
+    // Set by the render thread, called from every producer thread.
+    static std::atomic<void (*)()> wakeCallback{nullptr};
+    static std::atomic<bool> wakePending{false};
+
+    void setWakeCallback(void (*wake)()) {
+        wakeCallback.store(wake, std::memory_order_release);
+    }
+
+    // Wakes the render loop once; popQueue re-arms it.
+    static void wake() {
+        void (*callback)() = wakeCallback.load(std::memory_order_acquire);
+        if(callback && !wakePending.exchange(true, std::memory_order_acq_rel)) callback();
+    }
+
+    void wakeRender() {
+        wake();
+    }
+
+    // Pushes unless the ring is full or the batch would take the queue past
+    // MaxQueuedBytes; an empty queue takes a batch of any size.
+    static bool tryPush(SampleBatch && batch) {
+        size_t bytes = batchBytes(batch);
+        size_t queued = queuedBytes.load(std::memory_order_relaxed);
+        if(queued > 0 && queued + bytes > MaxQueuedBytes) {
+            bytesFull.fetch_add(1, std::memory_order_relaxed);
             return false;
         }
-        lock.lock();
-        result = serverQueue.front();
-        serverQueue.pop();
-        lock.unlock();
+        // Counted first, so the consumer never subtracts what is not added yet.
+        queuedBytes.fetch_add(bytes, std::memory_order_relaxed);
+        if(serverQueue.push(std::move(batch))) return true;
+        queuedBytes.fetch_sub(bytes, std::memory_order_relaxed);
+        return false;
+    }
+
+    static bool dropOldest() {
+        SampleBatch oldest;
+        if(!serverQueue.pop(oldest)) return false;
+        queuedBytes.fetch_sub(batchBytes(oldest), std::memory_order_relaxed);
+        metrics.queueEvicted.add();
         return true;
     }
+
+    // Pushes under the overflow policy and tracks the queue high-water mark.
+    // Returns false only when the batch was rejected.
+    static bool enqueue(SampleBatch && batch) {
+        pushing.fetch_add(1);
+        bool coalescing = hasCoalesced.load();
+        bool pushed = !coalescing && tryPush(std::move(batch));
+        pushing.fetch_sub(1);
+        if(!pushed) {
+            int policy = coalescing ? OverflowCoalesce : overflowPolicy.load(std::memory_order_relaxed);
+            switch(policy) {
+            case OverflowDropOldest:
+                // Another producer may take the freed slot first, so retry a few times.
+                for(int tries = 0; ; tries++) {
+                    if(tries == 16) return false;
+                    dropOldest();
+                    if(tryPush(std::move(batch))) break;
+                }
+                break;
+            case OverflowCoalesce:
+                coalesce(batch);
+                wake();
+                return true;
+            default:
+                return false;
+            }
+        }
+        metrics.queueHighWater.update(serverQueue.depth());
+        wake();
+        return true;
+    }
+
+    static size_t popRing(std::vector<SampleBatch> & batches, size_t max) {
+        size_t first = batches.size();
+        size_t n = serverQueue.popBatch(batches, max);
+        for(size_t i = first; i < batches.size(); i++) {
+            queuedBytes.fetch_sub(batchBytes(batches[i]), std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    size_t popQueue(std::vector<SampleBatch> & batches, size_t max) {
+        wakePending.store(false, std::memory_order_release);
+        size_t n = popRing(batches, max);
+        // Everything in the ring was pushed before coalescing started, so
+        // the coalesced batch goes last. Once no producer is between its
+        // flag check and its ring push, none can be until the flag clears;
+        // the ring is drained once more for pushes that just finished.
+        if(n < max && hasCoalesced.load() && pushing.load() == 0) {
+            n += popRing(batches, max - n);
+            if(n < max) {
+                std::lock_guard<std::mutex> guard(coalesceLock);
+                batches.push_back(std::move(coalesced));
+                coalesced = SampleBatch{};
+                coalescedIndex.clear();
+                coalescedStale = 0;
+                hasCoalesced.store(false);
+                n++;
+            }
+        }
+        return n;
+    }
+
+    // For producers that retry until accepted (replay, derive), so the
+    // overflow policy is not applied. They never write the streams of
+    // coalescing producers, so they need not wait for the coalesced batch.
+    bool pushQueue(SampleBatch && batch) {
+        if(!tryPush(std::move(batch))) return false;
+        metrics.queueHighWater.update(serverQueue.depth());
+        wake();
+        return true;
+    }
+
+    QueueStats queueStats() {
+        return QueueStats{serverQueue.depth(), serverQueue.capacity(), serverQueue.overflows() + bytesFull.load(std::memory_order_relaxed),
+            metrics.queueEvicted.get(), metrics.queueCoalesced.get(), queuedBytes.load(std::memory_order_relaxed)};
+    }
     
+    static std::mutex statusLock;
+    static std::string statusJson = "{}";
+
+    void publishStatus(std::string status) {
+        std::lock_guard<std::mutex> guard(statusLock);
+        statusJson.swap(status);
+    }
+
+    UdpStats udpStats() {
+        return UdpStats{udpReceived.load(), udpMalformed.load(), udpDropped.load()};
+    }
+
+    using BodyParser = void (*)(const char * begin, const char * end, SampleBatch & batch);
+
+    static void ingest(const httplib::Request & req, httplib::Response & res, const httplib::ContentReader & content_reader, BodyParser parse, IngestSource source) {
+        if (req.is_multipart_form_data()) {
+            throw std::runtime_error("not implemented");
+        }
+        // Reused per worker thread; only very large bodies give memory back.
+        static thread_local std::string body;
+        body.clear();
+        if(body.capacity() > (64u << 20)) body.shrink_to_fit();
+        content_reader([&](const char *data, size_t data_length) {
+            body.append(data, data_length);
+            return true;
+        });
+        IngestMetrics & m = metrics.ingest[source];
+        m.requests.add();
+        m.bytes.add(body.size());
+        SampleBatch batch;
+        try {
+            ScopedTimer timer{m.parse};
+            parse(body.data(), body.data() + body.length(), batch);
+        }
+        catch(std::runtime_error & e) {
+            m.failures.add();
+            std::cout << "Invalid format: " << e.what() << std::endl;
+            res.status = 400;
+            return;
+        }
+        if(!enqueue(std::move(batch))) {
+            res.status = 429;
+            res.set_header("Retry-After", "1");
+        }
+    }
+
+    static void udpListen(socket_t sock) {
+        std::vector<char> buffer(65536);
+        while(udpRunning) {
+            int len = recvfrom(sock, buffer.data(), (int)buffer.size(), 0, nullptr, nullptr);
+            if(len <= 0) continue;
+            udpReceived++;
+            IngestMetrics & m = metrics.ingest[SourceUdp];
+            m.requests.add();
+            m.bytes.add(len);
+            SampleBatch batch;
+            try {
+                ScopedTimer timer{m.parse};
+                if(len >= (int)sizeof(FrameMagic) && memcmp(buffer.data(), FrameMagic, sizeof(FrameMagic)) == 0) {
+                    parseFrame(buffer.data(), buffer.data() + len, batch);
+                }
+                else {
+                    parseBody(buffer.data(), buffer.data() + len, batch);
+                }
+            }
+            catch(std::runtime_error & e) {
+                udpMalformed++;
+                m.failures.add();
+                continue;
+            }
+            if(!enqueue(std::move(batch))) {
+                udpDropped++;
+            }
+        }
+        httplib::detail::close_socket(sock);
+    }
+
+    static void initUdp(int port) {
+        socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if(sock == INVALID_SOCKET) {
+            std::cout << "Failed to create udp socket" << std::endl;
+            return;
+        }
+        // Wake up periodically so stopServer can join the listener.
+#ifdef _WIN32
+        DWORD timeout = 200;
+#else
+        timeval timeout{0, 200000};
+#endif
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+        int rcvbuf = 4 << 20;
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char *)&rcvbuf, sizeof(rcvbuf));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if(bind(sock, (sockaddr *)&addr, sizeof(addr)) != 0) {
+            std::cout << "Failed to bind udp port " << port << std::endl;
+            httplib::detail::close_socket(sock);
+            return;
+        }
+        udpRunning = true;
+        udpThread = std::thread(udpListen, sock);
+    }
+
+    // Long-lived NDJSON / chunked uploads: every complete line is parsed and
+    // queued from inside the content receiver instead of after the body ends.
+    static void ingestStream(httplib::Response & res, const httplib::ContentReader & content_reader) {
+        std::string pending;
+        bool tooLong = false;
+        uint64_t accepted = 0, malformed = 0, dropped = 0;
+        IngestMetrics & m = metrics.ingest[SourceStream];
+        m.requests.add();
+        auto parseLines = [&](const char * p, const char * end) {
+            ScopedTimer timer{m.parse};
+            SampleBatch batch;
+            while(p < end) {
+                const char * eol = std::find(p, end, '\n');
+                try {
+                    if(std::any_of(p, eol, [](char c) { return !isspace((unsigned char)c); })) {
+                        parseBody(p, eol, batch);
+                        accepted++;
+                    }
+                }
+                catch(std::runtime_error & e) {
+                    std::cout << "Invalid format: " << e.what() << std::endl;
+                    malformed++;
+                    m.failures.add();
+                }
+                p = eol + (eol < end);
+            }
+            if(!batch.empty() && !enqueue(std::move(batch))) {
+                dropped++;
+            }
+        };
+        content_reader([&](const char *data, size_t data_length) {
+            m.bytes.add(data_length);
+            pending.append(data, data_length);
+            size_t eol = pending.rfind('\n');
+            if(eol != std::string::npos) {
+                parseLines(pending.data(), pending.data() + eol);
+                pending.erase(0, eol + 1);
+            }
+            // Only the unfinished line is left; stop before it outgrows the queue bound.
+            tooLong = pending.size() > MaxStreamLine;
+            return !tooLong;
+        });
+        if(tooLong) {
+            m.failures.add();
+            res.status = 413;
+            res.set_content("line longer than " + std::to_string(MaxStreamLine) + " bytes\n", "text/plain");
+            return;
+        }
+        parseLines(pending.data(), pending.data() + pending.size());
+        std::stringstream ss;
+        ss << "accepted " << accepted << ", malformed " << malformed << ", dropped " << dropped << "\n";
+        res.set_content(ss.str(), "text/plain");
+        if(malformed) {
+            res.status = 400;
+        }
+        else if(dropped) {
+            res.status = 429;
+            res.set_header("Retry-After", "1");
+        }
+    }
+
+    // Chunked transfer alone is not enough: a chunked upload may still be
+    // one pretty-printed document for the whole-body parser.
+    static bool isStreamRequest(const httplib::Request & req) {
+        return req.get_header_value("Content-Type").rfind("application/x-ndjson", 0) == 0
+            || req.get_param_value("stream") == "1";
+    }
+
     void initServer(int port) {
+        initUdp(port);
         httpThread = std::thread([&,port]() {
             using namespace httplib;
+            // Streaming producers hold a worker each for the whole session.
+            // The read timeout stays at the library default (5 s) for every
+            // route, so a pausing stream sends blank lines as a heartbeat
+            // (the relay does every 2 s) and idle clients free their worker.
+            server.new_task_queue = [] { return new ThreadPool(64); };
             server.Post("/", [&](const Request &req, Response &res, const ContentReader &content_reader) {
-                if (req.is_multipart_form_data()) {
-                    throw std::runtime_error("not implemented");
-                } else {
-                    std::string body;
-                    content_reader([&](const char *data, size_t data_length) {
-                        body.append(data, data_length);
-                        return true;
-                    });
-                    Json::Value root;
-                    Json::String errors;
-                    Json::CharReaderBuilder builder;
-                    std::unique_ptr<Json::CharReader> const reader(builder.newCharReader());
-                    bool success = reader->parse(body.data(), body.data() + body.length(), &root, &errors);
-                    if (!success || !errors.empty()) {
-                        std::cout << "Error parsing json" << '\n' << body << '\n' << errors << '\n';
-                    }
-                    else {
-                        lock.lock();
-                        serverQueue.push(root);
-                        lock.unlock();
-                    }
+                if(isStreamRequest(req) && !req.is_multipart_form_data()) {
+                    ingestStream(res, content_reader);
+                }
+                else {
+                    ingest(req, res, content_reader, parseBody, SourceJson);
+                }
+            });
+            server.Post("/bin", [&](const Request &req, Response &res, const ContentReader &content_reader) {
+                ingest(req, res, content_reader, parseFrame, SourceBinary);
+            });
+            server.Post("/derive", [](const Request& req, Response& res) {
+                try {
+                    addSpectrogram(parseSpectrogram(req.body.data(), req.body.data() + req.body.size()));
+                }
+                catch(std::runtime_error & e) {
+                    res.status = 400;
+                    res.set_content(std::string(e.what()) + "\n", "text/plain");
                 }
             });
+            server.Get("/derive", [](const Request& req, Response& res) {
+                res.set_content(listDerived(), "application/json");
+            });
+            server.Get("/figures", [](const Request& req, Response& res) {
+                res.set_content(catalogJson(), "application/json");
+            });
+            server.Get("/data", [](const Request& req, Response& res) {
+                ReadQuery query{req.get_param_value("figure"), req.get_param_value("stream"), -INFINITY, INFINITY, 0,
+                    req.get_param_value("format") == "bin"};
+                if(req.has_param("from")) query.from = std::atof(req.get_param_value("from").c_str());
+                if(req.has_param("to")) query.to = std::atof(req.get_param_value("to").c_str());
+                if(req.has_param("points")) query.points = std::strtoull(req.get_param_value("points").c_str(), nullptr, 10);
+                std::string body, type;
+                res.status = readStream(query, body, type);
+                res.set_content(body, type.c_str());
+            });
             server.Get("/", [=](const Request& req, Response& res) {
                 res.set_content(ipipHtmlHelp(port), "text/html");
             });
+            server.Get("/metrics", [](const Request& req, Response& res) {
+                QueueStats queue = queueStats();
+                res.set_content(renderMetrics(queue.depth, queue.capacity, queue.overflow), "text/plain; version=0.0.4");
+            });
+            server.Get("/status", [](const Request& req, Response& res) {
+                std::lock_guard<std::mutex> guard(statusLock);
+                res.set_content(statusJson, "application/json");
+            });
             std::cout << ipipConsoleHelp(port) << std::endl;
             server.listen("0.0.0.0", port);
         });
@@ -61,6 +450,8 @@ namespace ipip {
     void stopServer() {
         server.stop();
         httpThread.join();
+        udpRunning = false;
+        if(udpThread.joinable()) udpThread.join();
     }
 
 }
\ No newline at end of file
@@ -1,8 +1,46 @@
 #pragma once
-#include<json/json.h>
+#include"sample.h"
+#include<vector>
+#include<cstdint>
+#include<string>
 
 namespace ipip{
+    struct QueueStats {
+        size_t depth;
+        size_t capacity;
+        uint64_t overflow;
+        uint64_t evicted;
+        uint64_t coalesced;
+        // Size of the queued samples, bounded next to the batch count.
+        size_t bytes;
+    };
+
+    // What producers get when the ingest queue is full. Reject answers HTTP
+    // 429 with Retry-After, DropOldest evicts the oldest queued batch, and
+    // Coalesce folds the new samples into one batch that keeps only the
+    // newest sample of every stream until the render thread catches up.
+    enum OverflowPolicy {
+        OverflowReject,
+        OverflowDropOldest,
+        OverflowCoalesce,
+    };
+
+    struct UdpStats {
+        uint64_t received;
+        uint64_t malformed;
+        uint64_t dropped;
+    };
+
     void initServer(int port);
     void stopServer();
-    bool popQueue(Json::Value & result);
-}
\ No newline at end of file
+    // Called (at most once per drain of the queue) when new samples are queued.
+    void setWakeCallback(void (*wake)());
+    // Wakes the render loop as if samples were queued.
+    void wakeRender();
+    size_t popQueue(std::vector<SampleBatch> & batches, size_t max = SIZE_MAX);
+    bool pushQueue(SampleBatch && batch);
+    QueueStats queueStats();
+    void setOverflowPolicy(OverflowPolicy policy);
+    UdpStats udpStats();
+    void publishStatus(std::string status);
+}
@@ -0,0 +1,294 @@
+#include "snapshot.h"
+#include "server.h"
+#include <json/json.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+namespace ipip {
+
+    Chunk::Chunk(int width):
+        width{width}, capacity{std::max<size_t>(1, Values / width)},
+        time{new double[capacity]}, value{new double[capacity * width]} {}
+
+    void StreamMirror::push(double time, const double * value, int width) {
+        if(chunks.empty() || chunks.back()->rows == chunks.back()->capacity || chunks.back()->width != width) {
+            chunks.push_back(std::make_shared<Chunk>(width));
+        }
+        Chunk & chunk = *chunks.back();
+        chunk.time[chunk.rows] = time;
+        std::copy(value, value + width, chunk.value.get() + chunk.rows * width);
+        chunk.rows++;
+    }
+
+    void StreamMirror::trim(double before) {
+        while(chunks.size() > 1 && chunks.front()->time[chunks.front()->rows - 1] < before) {
+            chunks.pop_front();
+        }
+    }
+
+    void StreamMirror::clear() {
+        chunks.clear();
+        published = UINT64_MAX;
+    }
+
+    size_t StreamMirror::memoryBytes() const {
+        size_t bytes = 0;
+        for(auto & chunk: chunks) bytes += chunk->capacity * (1 + chunk->width) * sizeof(double);
+        return bytes;
+    }
+
+    std::shared_ptr<const StreamSnapshot> StreamMirror::snapshot(int width, double origin, double front) const {
+        auto snap = std::make_shared<StreamSnapshot>();
+        snap->width = width;
+        snap->origin = origin;
+        snap->first = 0;
+        for(auto & chunk: chunks) {
+            if(chunk->width != width) continue;
+            snap->chunks.push_back(chunk);
+            snap->rows.push_back(chunk->rows);
+        }
+        if(!snap->chunks.empty()) {
+            const double * time = snap->chunks[0]->time.get();
+            snap->first = std::lower_bound(time, time + snap->rows[0], front) - time;
+        }
+        return snap;
+    }
+
+    static std::mutex catalogLock;
+    static std::vector<StreamInfo> catalog;
+
+    // Snapshots by stream key, and when each stream was last read.
+    static std::mutex readLock;
+    static std::condition_variable readReady;
+    static std::unordered_map<uint64_t, std::shared_ptr<const StreamSnapshot>> snapshots;
+    static std::unordered_map<uint64_t, std::chrono::steady_clock::time_point> lastRead;
+    static const auto ReadTimeout = std::chrono::seconds(60);
+
+    void publishCatalog(std::vector<StreamInfo> streams) {
+        std::lock_guard<std::mutex> guard(catalogLock);
+        catalog.swap(streams);
+    }
+
+    std::vector<uint64_t> wantedStreams() {
+        std::vector<uint64_t> keys;
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> guard(readLock);
+        for(auto it = lastRead.begin(); it != lastRead.end();) {
+            if(now - it->second > ReadTimeout) {
+                it = lastRead.erase(it);
+                continue;
+            }
+            keys.push_back(it->first);
+            ++it;
+        }
+        std::sort(keys.begin(), keys.end());
+        return keys;
+    }
+
+    void publishSnapshot(uint64_t key, std::shared_ptr<const StreamSnapshot> snapshot) {
+        {
+            std::lock_guard<std::mutex> guard(readLock);
+            snapshots[key] = std::move(snapshot);
+        }
+        readReady.notify_all();
+    }
+
+    void dropSnapshot(uint64_t key) {
+        std::lock_guard<std::mutex> guard(readLock);
+        snapshots.erase(key);
+    }
+
+    void clearSnapshots() {
+        {
+            std::lock_guard<std::mutex> guard(readLock);
+            snapshots.clear();
+        }
+        publishCatalog({});
+    }
+
+    std::string catalogJson() {
+        Json::Value root = Json::objectValue;
+        {
+            std::lock_guard<std::mutex> guard(catalogLock);
+            for(auto & info: catalog) {
+                Json::Value & st = root[info.figure][info.name];
+                st["width"] = info.width;
+                st["samples"] = (Json::UInt64)info.samples;
+                st["stored"] = (Json::UInt64)info.stored;
+                if(!std::isnan(info.latest)) st["latest"] = info.latest;
+            }
+        }
+        Json::StreamWriterBuilder builder;
+        builder["indentation"] = "";
+        return Json::writeString(builder, root);
+    }
+
+    struct Row {
+        const Chunk * chunk;
+        size_t row;
+    };
+
+    // Rows with from <= time <= to, in stored time.
+    static std::vector<Row> selectRows(const StreamSnapshot & snap, double from, double to) {
+        std::vector<Row> rows;
+        for(size_t c = 0; c < snap.chunks.size(); c++) {
+            const Chunk & chunk = *snap.chunks[c];
+            const double * time = chunk.time.get();
+            const double * begin = std::lower_bound(time + (c == 0 ? snap.first : 0), time + snap.rows[c], from);
+            const double * end = std::upper_bound(begin, time + snap.rows[c], to);
+            for(const double * t = begin; t < end; t++) rows.push_back(Row{&chunk, size_t(t - time)});
+        }
+        return rows;
+    }
+
+    static double timeOf(const Row & r) { return r.chunk->time[r.row]; }
+
+    // Time buckets over the selected range: the min and max row of each for
+    // scalar streams, the first row of each for heatmaps.
+    static std::vector<Row> downsample(const std::vector<Row> & rows, int width, size_t points) {
+        if(points == 0 || rows.size() <= points) return rows;
+        size_t buckets = width == 1 ? std::max<size_t>(1, points / 2) : points;
+        double t0 = timeOf(rows.front()), span = timeOf(rows.back()) - t0;
+        auto bucketOf = [&](const Row & r) {
+            return span > 0 ? std::min(buckets - 1, size_t((timeOf(r) - t0) / span * buckets)) : 0;
+        };
+        std::vector<Row> out;
+        size_t current = SIZE_MAX, lo = 0, hi = 0;
+        auto flush = [&]() {
+            if(current == SIZE_MAX) return;
+            out.push_back(rows[std::min(lo, hi)]);
+            if(lo != hi) out.push_back(rows[std::max(lo, hi)]);
+        };
+        for(size_t i = 0; i < rows.size(); i++) {
+            size_t b = bucketOf(rows[i]);
+            if(b != current) {
+                if(width > 1) {
+                    out.push_back(rows[i]);
+                    current = b;
+                    continue;
+                }
+                flush();
+                current = b;
+                lo = hi = i;
+                continue;
+            }
+            if(width > 1) continue;
+            double v = rows[i].chunk->value[rows[i].row];
+            if(v < rows[lo].chunk->value[rows[lo].row]) lo = i;
+            if(v > rows[hi].chunk->value[rows[hi].row]) hi = i;
+        }
+        if(width == 1) flush();
+        return out;
+    }
+
+    static void appendNumber(std::string & out, double v) {
+        if(!std::isfinite(v)) {
+            out += "null";
+            return;
+        }
+        char buf[32];
+        out.append(buf, snprintf(buf, sizeof(buf), "%.17g", v));
+    }
+
+    static void appendString(std::string & out, const std::string & s) {
+        out += '"';
+        for(char c: s) {
+            if(c == '"' || c == '\\') out += '\\';
+            if((unsigned char)c < 0x20) {
+                char buf[8];
+                out.append(buf, snprintf(buf, sizeof(buf), "\\u%04x", c));
+                continue;
+            }
+            out += c;
+        }
+        out += '"';
+    }
+
+    int readStream(const ReadQuery & query, std::string & body, std::string & type) {
+        type = "text/plain";
+        uint64_t key = UINT64_MAX;
+        {
+            std::lock_guard<std::mutex> guard(catalogLock);
+            for(auto & info: catalog) {
+                if(info.figure == query.figure && info.name == query.stream) key = streamKey(info.subplot, info.stream);
+            }
+        }
+        if(key == UINT64_MAX) {
+            body = "unknown stream\n";
+            return 404;
+        }
+        // A stream is mirrored once it is read, so the first read waits for
+        // the render thread to publish.
+        std::shared_ptr<const StreamSnapshot> snap;
+        {
+            std::unique_lock<std::mutex> guard(readLock);
+            lastRead[key] = std::chrono::steady_clock::now();
+            auto ready = [&] {
+                auto it = snapshots.find(key);
+                if(it == snapshots.end()) return false;
+                snap = it->second;
+                return true;
+            };
+            if(!ready()) {
+                guard.unlock();
+                wakeRender();
+                guard.lock();
+                if(!readReady.wait_for(guard, std::chrono::seconds(2), ready)) {
+                    body = "snapshot not ready, retry\n";
+                    return 503;
+                }
+            }
+        }
+        std::vector<Row> rows = downsample(selectRows(*snap, query.from - snap->origin, query.to - snap->origin), snap->width, query.points);
+        int width = snap->width;
+        body.clear();
+        if(query.binary) {
+            type = "application/octet-stream";
+            uint32_t header[2] = {(uint32_t)rows.size(), (uint32_t)width};
+            body.resize(sizeof(header) + rows.size() * (1 + width) * sizeof(double));
+            char * p = &body[0];
+            memcpy(p, header, sizeof(header));
+            p += sizeof(header);
+            for(auto & r: rows) {
+                double t = timeOf(r) + snap->origin;
+                memcpy(p, &t, sizeof(t));
+                p += sizeof(t);
+            }
+            for(auto & r: rows) {
+                memcpy(p, r.chunk->value.get() + r.row * width, width * sizeof(double));
+                p += width * sizeof(double);
+            }
+            return 200;
+        }
+        type = "application/json";
+        body.reserve(rows.size() * (1 + width) * 12 + 128);
+        body += "{\"figure\":";
+        appendString(body, query.figure);
+        body += ",\"stream\":";
+        appendString(body, query.stream);
+        body += ",\"width\":" + std::to_string(width) + ",\"time\":[";
+        for(size_t i = 0; i < rows.size(); i++) {
+            if(i) body += ',';
+            appendNumber(body, timeOf(rows[i]) + snap->origin);
+        }
+        body += "],\"value\":[";
+        bool first = true;
+        for(auto & r: rows) {
+            const double * v = r.chunk->value.get() + r.row * width;
+            for(int k = 0; k < width; k++) {
+                if(!first) body += ',';
+                first = false;
+                appendNumber(body, v[k]);
+            }
+        }
+        body += "]}";
+        return 200;
+    }
+
+} // namespace ipip
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ipip {
+
+    // Read side of stream storage for GET /figures and GET /data.
+    //
+    // A stream that is being read gets a mirror of its rows in append-only
+    // chunks allocated at full size. The render thread only ever writes rows
+    // past the count it published, so HTTP threads read published snapshots
+    // without locks while ingest keeps appending. Mirrors of streams nobody
+    // read for a minute are dropped again.
+
+    struct Chunk {
+        static const size_t Values = size_t(1) << 14;
+
+        int width;
+        size_t capacity;
+        size_t rows{0};
+        std::unique_ptr<double[]> time;
+        std::unique_ptr<double[]> value;
+
+        explicit Chunk(int width);
+    };
+
+    // Rows [first, end) of the published chunks, end being `rows.back()` in
+    // the last chunk. Times are stored relative to `origin`.
+    struct StreamSnapshot {
+        int width;
+        double origin;
+        size_t first;
+        std::vector<std::shared_ptr<const Chunk>> chunks;
+        std::vector<size_t> rows;
+    };
+
+    // Owned by the render thread, alongside the stream's RingStore.
+    struct StreamMirror {
+        std::deque<std::shared_ptr<Chunk>> chunks;
+        uint64_t published{UINT64_MAX};
+
+        void push(double time, const double * value, int width);
+        // Drops whole chunks older than `before`.
+        void trim(double before);
+        void clear();
+        size_t memoryBytes() const;
+        std::shared_ptr<const StreamSnapshot> snapshot(int width, double origin, double front) const;
+    };
+
+    struct StreamInfo {
+        uint32_t subplot;
+        uint32_t stream;
+        std::string figure;
+        std::string name;
+        int width;
+        uint64_t samples;
+        uint64_t stored;
+        double latest;
+    };
+
+    inline uint64_t streamKey(uint32_t subplot, uint32_t stream) {
+        return (uint64_t(subplot) << 32) | stream;
+    }
+
+    // Render thread.
+    void publishCatalog(std::vector<StreamInfo> streams);
+    // Sorted keys of the streams read recently.
+    std::vector<uint64_t> wantedStreams();
+    void publishSnapshot(uint64_t key, std::shared_ptr<const StreamSnapshot> snapshot);
+    void dropSnapshot(uint64_t key);
+    void clearSnapshots();
+
+    // HTTP threads.
+    struct ReadQuery {
+        std::string figure;
+        std::string stream;
+        double from;
+        double to;
+        size_t points;
+        bool binary;
+    };
+
+    std::string catalogJson();
+    // Fills `body` and `type` and returns the HTTP status. JSON is
+    // {"figure", "stream", "width", "time": [...], "value": [...]} with the
+    // values row-major; binary is u32 rows, u32 width, f64 time[rows],
+    // f64 value[rows][width], little-endian. Downsampling to `points` keeps
+    // the min and max row of every time bucket for scalar streams, and the
+    // first row of every bucket for heatmaps.
+    int readStream(const ReadQuery & query, std::string & body, std::string & type);
+
+} // namespace ipip
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ipip {
+
+    // Log-bucketed quantile sketch (DDSketch) that also supports removal, so
+    // it can follow a sliding window. Quantiles are within 1% relative error.
+    struct QuantileSketch {
+        static constexpr double Alpha = 0.01;
+        static constexpr double MinValue = 1e-9;
+
+        // Counts of one sign, by key of the magnitude.
+        struct Bins {
+            int offset{0};
+            std::vector<uint32_t> counts;
+
+            void add(int key, int delta) {
+                if(counts.empty()) offset = key;
+                if(key < offset) {
+                    counts.insert(counts.begin(), offset - key, 0);
+                    offset = key;
+                }
+                if(key >= offset + (int)counts.size()) counts.resize(key - offset + 1, 0);
+                counts[key - offset] += delta;
+            }
+
+            void clear() { counts.clear(); }
+        };
+
+        Bins pos, neg;
+        uint64_t zeros{0};
+        uint64_t count{0};
+
+        // Keys come from a piecewise linear log2 (exponent plus mantissa),
+        // which avoids calling log per sample. Its slope varies by at most 2x,
+        // so buckets are ln(gamma) wide to keep the error bound.
+        static double width() {
+            static const double value = std::log((1 + Alpha) / (1 - Alpha));
+            return value;
+        }
+
+        static int key(double v) {
+            int e;
+            double m = std::frexp(v, &e);
+            return (int)std::ceil((e - 2 + 2 * m) / width());
+        }
+
+        static double inverse(double f) {
+            double e = std::floor(f);
+            return std::ldexp(1 + f - e, (int)e);
+        }
+
+        static double estimate(int key) {
+            double lo = inverse((key - 1) * width()), hi = inverse(key * width());
+            return 2 * lo * hi / (lo + hi);
+        }
+
+        void add(double v, int delta = 1) {
+            if(std::isnan(v)) return;
+            if(v > MinValue) pos.add(key(v), delta);
+            else if(v < -MinValue) neg.add(key(-v), delta);
+            else zeros += delta;
+            count += delta;
+        }
+
+        void remove(double v) { add(v, -1); }
+
+        // Trims empty buckets at both ends so the arrays track the live range.
+        static void trim(Bins & bins) {
+            auto & c = bins.counts;
+            size_t lo = 0, hi = c.size();
+            while(lo < hi && c[lo] == 0) lo++;
+            while(hi > lo && c[hi - 1] == 0) hi--;
+            if(lo == 0 && hi == c.size()) return;
+            c.erase(c.begin() + hi, c.end());
+            c.erase(c.begin(), c.begin() + lo);
+            bins.offset += (int)lo;
+        }
+
+        double quantile(double q) const {
+            if(count == 0) return NAN;
+            uint64_t rank = (uint64_t)(q * (count - 1));
+            uint64_t seen = 0;
+            for(size_t i = neg.counts.size(); i-- > 0;) {
+                seen += neg.counts[i];
+                if(seen > rank) return -estimate(neg.offset + (int)i);
+            }
+            seen += zeros;
+            if(seen > rank) return 0;
+            for(size_t i = 0; i < pos.counts.size(); i++) {
+                seen += pos.counts[i];
+                if(seen > rank) return estimate(pos.offset + (int)i);
+            }
+            return pos.counts.empty() ? 0 : estimate(pos.offset + (int)pos.counts.size() - 1);
+        }
+
+        void clear() {
+            pos.clear();
+            neg.clear();
+            zeros = count = 0;
+        }
+    };
+
+    // Growable circular buffer with deque-style access at both ends.
+    template<class T> struct RingDeque {
+        std::vector<T> items{std::vector<T>(16)};
+        size_t head{0}, count{0};
+
+        bool empty() const { return count == 0; }
+        size_t size() const { return count; }
+        T & front() { return items[head]; }
+        const T & front() const { return items[head]; }
+        T & back() { return items[(head + count - 1) & (items.size() - 1)]; }
+        const T & operator[](size_t i) const { return items[(head + i) & (items.size() - 1)]; }
+        void pop_front() { head = (head + 1) & (items.size() - 1); count--; }
+        void pop_back() { count--; }
+        void clear() { head = count = 0; }
+
+        void push_back(const T & item) {
+            if(count == items.size()) {
+                std::vector<T> grown(items.size() * 2);
+                for(size_t i = 0; i < count; i++) grown[i] = (*this)[i];
+                items.swap(grown);
+                head = 0;
+            }
+            items[(head + count++) & (items.size() - 1)] = item;
+        }
+    };
+
+    // Statistics of the rows received in the last `span` seconds, updated in
+    // O(1) amortized per row: shifted running sums for mean, deviation and
+    // RMS, monotonic deques for the extremes and a quantile sketch. Rows of
+    // width > 1 (heatmaps) only track the extremes of their values.
+    struct RollingStats {
+        struct Entry {
+            double time;
+            double value;
+        };
+
+        RingDeque<Entry> window;
+        RingDeque<Entry> maxq, minq;
+        QuantileSketch sketch;
+        // Sums of (value - shift), re-based when the window is recomputed.
+        double shift{0}, sum{0}, sumsq{0};
+        size_t evictions{0};
+
+        void add(double time, const double * values, size_t count, double span) {
+            double lo = values[0], hi = values[0];
+            for(size_t i = 1; i < count; i++) {
+                lo = std::min(lo, values[i]);
+                hi = std::max(hi, values[i]);
+            }
+            while(!maxq.empty() && maxq.back().value <= hi) maxq.pop_back();
+            maxq.push_back(Entry{time, hi});
+            while(!minq.empty() && minq.back().value >= lo) minq.pop_back();
+            minq.push_back(Entry{time, lo});
+            if(count == 1) {
+                if(window.empty()) shift = lo;
+                window.push_back(Entry{time, lo});
+                sum += lo - shift;
+                sumsq += (lo - shift) * (lo - shift);
+                sketch.add(lo);
+            }
+            evict(time - span);
+        }
+
+        void evict(double before) {
+            while(!maxq.empty() && maxq.front().time < before) maxq.pop_front();
+            while(!minq.empty() && minq.front().time < before) minq.pop_front();
+            bool removed = false;
+            while(!window.empty() && window.front().time < before) {
+                double d = window.front().value - shift;
+                sum -= d;
+                sumsq -= d * d;
+                sketch.remove(window.front().value);
+                window.pop_front();
+                evictions++;
+                removed = true;
+            }
+            if(!removed) return;
+            // Re-sum once per window length to cancel rounding drift.
+            if(evictions >= std::max<size_t>(1024, window.size())) recompute();
+        }
+
+        void recompute() {
+            evictions = 0;
+            sum = sumsq = 0;
+            if(window.empty()) return;
+            double total = 0;
+            for(size_t i = 0; i < window.size(); i++) total += window[i].value;
+            shift = total / window.size();
+            for(size_t i = 0; i < window.size(); i++) {
+                double d = window[i].value - shift;
+                sum += d;
+                sumsq += d * d;
+            }
+            QuantileSketch::trim(sketch.pos);
+            QuantileSketch::trim(sketch.neg);
+        }
+
+        void clear() {
+            window.clear();
+            maxq.clear();
+            minq.clear();
+            sketch.clear();
+            shift = sum = sumsq = 0;
+            evictions = 0;
+        }
+
+        bool empty() const { return maxq.empty(); }
+        size_t count() const { return window.size(); }
+        double min() const { return minq.empty() ? NAN : minq.front().value; }
+        double max() const { return maxq.empty() ? NAN : maxq.front().value; }
+        double mean() const { return window.empty() ? NAN : shift + sum / window.size(); }
+
+        double stddev() const {
+            if(window.empty()) return NAN;
+            double m = sum / window.size();
+            return std::sqrt(std::max(0.0, sumsq / window.size() - m * m));
+        }
+
+        double rms() const {
+            if(window.empty()) return NAN;
+            // E[v^2] = E[(v - s)^2] + 2 s E[v - s] + s^2
+            double n = window.size();
+            return std::sqrt(std::max(0.0, sumsq / n + 2 * shift * sum / n + shift * shift));
+        }
+
+        double quantile(double q) const { return sketch.quantile(q); }
+    };
+
+} // namespace ipip
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace ipip {
+
+    // Circular store of (time, value[width]) rows kept in fixed-size chunks,
+    // each holding a time array and a value array. Logical row 0 is the
+    // oldest one. Chunks are added while the oldest chunk is still inside the
+    // retention span and the oldest one is reused (or freed, when several
+    // have expired) once it falls out of it, so rows are never copied and the
+    // memory follows the span times the sample rate in both directions.
+    struct RingStore {
+        static constexpr size_t ChunkValues = size_t(1) << 16;
+        static constexpr size_t MaxChunkRows = 1024;
+        static constexpr size_t MaxValues = size_t(1) << 24;
+
+        struct Chunk {
+            std::unique_ptr<double[]> time;
+            std::unique_ptr<double[]> value;
+        };
+
+        int width{1};
+        uint64_t pushed{0};
+        uint64_t resets{0};
+
+        size_t capacity() const { return chunks.size() << shift; }
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        double timeAt(size_t row) const {
+            size_t i = offset + row;
+            return chunks[i >> shift].time[i & mask];
+        }
+        const double * valueAt(size_t row) const {
+            size_t i = offset + row;
+            return chunks[i >> shift].value.get() + (i & mask) * width;
+        }
+        double front() const { return timeAt(0); }
+        double back() const { return timeAt(count - 1); }
+        size_t bytes() const { return capacity() * (1 + width) * sizeof(double); }
+
+        void reset(int width) {
+            this->width = width;
+            // A power of two, so rows are found with a shift and a mask.
+            size_t rows = std::max<size_t>(1, std::min(MaxChunkRows, ChunkValues / width));
+            for(shift = 0; (size_t(2) << shift) <= rows; shift++) {}
+            mask = (size_t(1) << shift) - 1;
+            chunks.clear();
+            offset = count = 0;
+            resets++;
+        }
+
+        // Appends a row. Rows older than `keep` seconds before `t` are
+        // dropped a chunk at a time when the newest chunk is full; a chunk
+        // starting after `t` is dropped as well, since time went backwards.
+        void push(double t, const double * v, double keep) {
+            size_t end = offset + count;
+            if(end == capacity()) {
+                Chunk reuse;
+                while(chunks.size() > 1 && (expired(t, keep) || capacity() * width >= MaxValues)) {
+                    count -= (mask + 1) - offset;
+                    offset = 0;
+                    reuse = std::move(chunks.front());
+                    chunks.erase(chunks.begin());
+                }
+                if(!reuse.time) {
+                    reuse.time.reset(new double[mask + 1]);
+                    reuse.value.reset(new double[(mask + 1) * width]);
+                }
+                chunks.push_back(std::move(reuse));
+                end = offset + count;
+            }
+            Chunk & chunk = chunks[end >> shift];
+            chunk.time[end & mask] = t;
+            std::copy(v, v + width, chunk.value.get() + (end & mask) * width);
+            count++;
+            pushed++;
+        }
+
+        // First logical row with time >= t, assuming time grows monotonically.
+        size_t lowerBound(double t) const {
+            size_t lo = 0, hi = count;
+            while(lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if(timeAt(mid) < t) lo = mid + 1;
+                else hi = mid;
+            }
+            return lo;
+        }
+
+        // Calls f(time, value, rows) for the contiguous pieces of the logical
+        // rows [begin, end), one per chunk.
+        template<class F> void segments(size_t begin, size_t end, F f) const {
+            while(begin < end) {
+                size_t i = offset + begin;
+                size_t n = std::min(end - begin, (mask + 1) - (i & mask));
+                const Chunk & chunk = chunks[i >> shift];
+                f(chunk.time.get() + (i & mask), chunk.value.get() + (i & mask) * width, n);
+                begin += n;
+            }
+        }
+
+    private:
+        std::vector<Chunk> chunks;
+        size_t shift{0};
+        size_t mask{0};
+        // Logical row 0 is row `offset` of the first chunk.
+        size_t offset{0};
+        size_t count{0};
+
+        bool expired(double t, double keep) const {
+            const Chunk & oldest = chunks.front();
+            return oldest.time[mask] < t - keep || oldest.time[offset] > t;
+        }
+    };
+
+} // namespace ipip
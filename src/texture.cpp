@@ -0,0 +1,122 @@
+#include "texture.h"
+#include "heatmap.h"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+
+namespace ipip {
+
+    static bool glAlive = true;
+
+    HeatTexture::~HeatTexture() {
+        if(glAlive) release();
+    }
+
+    void HeatTexture::release() {
+        if(id) {
+            GLuint tex = id;
+            glDeleteTextures(1, &tex);
+        }
+        id = 0;
+        rows = 0;
+    }
+
+    void HeatTexture::contextLost() {
+        glAlive = false;
+    }
+
+    size_t HeatTexture::firstRow(const RingStore & store) const {
+        return store.size() - std::min<size_t>(store.size(), rows);
+    }
+
+    void HeatTexture::upload(const RingStore & store, uint64_t begin, uint64_t end) {
+        double range = scale[1] - scale[0];
+        double k = range > 0 ? 255.0 / range : 0;
+        while(begin < end) {
+            int row = begin % rows;
+            int n = (int)std::min<uint64_t>(end - begin, rows - row);
+            pixels.resize(size_t(n) * width);
+            size_t first = store.size() - (store.pushed - begin);
+            for(int r = 0; r < n; r++) {
+                const double * v = store.valueAt(first + r);
+                ImU32 * out = pixels.data() + size_t(r) * width;
+                for(int c = 0; c < width; c++) {
+                    double t = (v[c] - scale[0]) * k;
+                    // NaN fails both comparisons and takes the lowest color.
+                    out[c] = lut[!(t > 0) ? 0 : t >= 255 ? 255 : int(t + 0.5)];
+                }
+            }
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row, width, n, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            begin += n;
+        }
+    }
+
+    bool HeatTexture::sync(const RingStore & store, size_t visible, double vmin, double vmax, int colormap) {
+        static GLint maxSize = 0;
+        if(maxSize == 0) glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+        // Rounded up to a power of two and never shrunk, so the texture is
+        // not recreated every time the store gains or drops a chunk.
+        size_t need = 1024;
+        while(need < store.size() && need < (size_t)MaxRows) need *= 2;
+        int wantRows = (int)std::min<size_t>(std::max<size_t>(need, rows), std::min<GLint>(MaxRows, maxSize));
+        if(store.width > maxSize || wantRows <= 0) return false;
+
+        GLint last;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &last);
+        bool full = false;
+        if(!id) {
+            GLuint tex;
+            glGenTextures(1, &tex);
+            id = tex;
+        }
+        glBindTexture(GL_TEXTURE_2D, id);
+        if(wantRows != rows || store.width != width) {
+            rows = wantRows;
+            width = store.width;
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, rows, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            full = true;
+        }
+        if(colormap != this->colormap) {
+            this->colormap = colormap;
+            for(int i = 0; i < 256; i++) {
+                lut[i] = ImGui::ColorConvertFloat4ToU32(ImPlot::SampleColormap(i / 255.0f, colormap));
+            }
+            full = true;
+        }
+        if(vmin != scale[0] || vmax != scale[1] || store.resets != resets) {
+            scale[0] = vmin;
+            scale[1] = vmax;
+            resets = store.resets;
+            full = true;
+        }
+        uint64_t first = store.pushed - std::min<uint64_t>({store.size(), (uint64_t)rows, visible});
+        // After a change, or rows skipped while the stream was not drawn,
+        // everything visible is colored anew.
+        if(full || uploaded < first) fresh = uploaded = store.pushed;
+        // Visible rows not colored since the last change, then the new ones.
+        if(first < fresh) upload(store, first, fresh);
+        upload(store, uploaded, store.pushed);
+        fresh = std::min(fresh, first);
+        uploaded = store.pushed;
+        glBindTexture(GL_TEXTURE_2D, last);
+        return true;
+    }
+
+    void HeatTexture::plot(const char * label, const RingStore & store, size_t begin, size_t end, double x0, double x1) const {
+        begin = std::max(begin, firstRow(store));
+        if(begin >= end) return;
+        uint64_t sample = store.pushed - store.size() + begin;
+        double v0 = double(sample % rows) / rows;
+        double v1 = v0 + double(end - begin) / rows;
+        ImPlot::PlotHeatmapImage(label, (ImTextureID)(intptr_t)id, v0, v1, ImPlotPoint(x0, 0), ImPlotPoint(x1, 1));
+    }
+
+} // namespace ipip
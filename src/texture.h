@@ -0,0 +1,57 @@
+#pragma once
+
+#include <imgui.h>
+#include <implot.h>
+#include <cstdint>
+#include <vector>
+#include "storage.h"
+
+namespace ipip {
+
+    // GPU copy of a heatmap stream: one RGBA texel row per sample, indexed by
+    // sample number modulo the texture height, so each new sample is a single
+    // glTexSubImage2D row upload. Colors come from a 256 entry LUT of the
+    // current colormap; when the LUT or the value scale changes only the
+    // visible rows are recolored, older ones once they come into view.
+    struct HeatTexture {
+        static constexpr int MaxRows = 8192;
+
+        HeatTexture() = default;
+        HeatTexture(const HeatTexture &) = delete;
+        HeatTexture & operator=(const HeatTexture &) = delete;
+        ~HeatTexture();
+
+        // Frees the GL texture; needs the context to be current.
+        void release();
+        // Called once the GL context is gone, so later destructors (static
+        // streams among them) skip the GL call.
+        static void contextLost();
+
+        // Uploads whatever changed since the last call among the newest
+        // `visible` rows. Returns false when the stream does not fit in a
+        // texture and the caller should fall back to the CPU mesh.
+        bool sync(const RingStore & store, size_t visible, double vmin, double vmax, int colormap);
+
+        // Draws logical rows [begin, end) of `store` between plot x0 and x1.
+        void plot(const char * label, const RingStore & store, size_t begin, size_t end, double x0, double x1) const;
+
+        // Oldest logical row of `store` that is still held by the texture.
+        size_t firstRow(const RingStore & store) const;
+
+    private:
+        unsigned int id{0};
+        int width{0};
+        int rows{0};
+        int colormap{-1};
+        double scale[2]{0, 0};
+        // Samples [fresh, uploaded) are colored with the current LUT and scale.
+        uint64_t fresh{0};
+        uint64_t uploaded{0};
+        uint64_t resets{0};
+        ImU32 lut[256];
+        std::vector<ImU32> pixels;
+
+        void upload(const RingStore & store, uint64_t begin, uint64_t end);
+    };
+
+} // namespace ipip